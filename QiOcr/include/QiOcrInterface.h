@@ -12,19 +12,132 @@
 #pragma comment(lib,"qiocr.lib")
 #endif
 
+struct QiOcrConfig
+{
+	unsigned int size = sizeof(QiOcrConfig);	// set by the caller's header, the library reads and writes only this much
+	int recWidthBucket = 32;		// rec input width is padded up to a multiple of this, 0 = off
+	int recBucketMaxWidth = 1280;	// widths above this are left unpadded
+	int recShapeSessions = 0;		// extra rec sessions specialized for hot widths, 0 = off
+	int detShapeSessions = 0;		// extra det sessions specialized for repeated input sizes, 0 = off
+	int geometryCache = 4;			// input shapes kept with their buffers and bindings, 0 = off
+	int recChunkWidth = 1280;		// wider rec lines are split into overlapping windows, 0 = off
+	int recChunkOverlap = 48;		// window overlap around each cut, in rec pixels
+	int recBatchSize = 8;			// rec inputs run together when the model has a dynamic batch
+	int recPackWidth = 0;			// short rec lines are packed side by side into inputs up to this wide, 0 = off
+	int recPackGap = 32;			// background columns between packed lines
+	int recTrimPad = 4;				// crops are trimmed to their ink extent plus this many pixels, -1 = off
+	bool rejectCrops = false;		// det crops under any of the following thresholds are not recognized
+	float rejectMinBoxScore = 0.5f;	// each threshold 0 = off
+	float rejectMinContrast = 24.0f;
+	float rejectMinStdDev = 4.0f;
+	float rejectMinEdgeDensity = 0.01f;	// share of neighbour steps of at least rejectMinContrast
+	int recCacheBytes = 1 << 20;	// memory bound of the rec result cache, 0 = off
+	int recCacheTolerance = -1;		// -1 = exact pixel hash, otherwise max differing bits of the block signature
+	bool incremental = false;		// successive same-size frames only re-detect changed tiles
+	int incrementalTile = 64;		// diff tile size, rounded up to a multiple of 32
+	int pointWindowWidth = 256;		// first det window around a scan_point, grown while the hit line touches its edge
+	int pointWindowHeight = 64;
+	bool lazyInit = false;			// models load on first use instead of in parallel at init
+	int arenaShrinkPixels = 1 << 22;	// runs on larger inputs give their arena growth and buffers back afterwards, 0 = off
+	int idleUnloadMs = 0;			// sessions are released after this long without a call and reloaded on the next one, 0 = off
+	int detTilePixels = 1 << 24;	// det inputs above this many pixels run as overlapping tiles, 0 = off
+	int detTileSize = 1024;			// tile edge, rounded up to a multiple of 32
+	int detTileOverlap = 64;		// tiles overlap by this much and keep only their interior
+	int detCoarseScale = 0;			// det probes a 1/N copy first and runs full resolution only on its text regions, 0 = off
+	int detMaskTile = 64;			// det pre-pass tile size
+	float detMaskMinEdgeDensity = 0.0f;	// tiles with a smaller share of edges of at least rejectMinContrast are cut from det, none left = no det, 0 = off
+	bool detAutoScale = false;		// det downscales for the large text of earlier full-frame scan_list/scan calls and re-detects small text upscaled
+	bool lineAssembly = true;		// det fragments of one line are merged into a single rec input, lines come in reading order
+	float lineMaxGap = 0.0f;		// largest gap between fragments of a line, in line heights of the margin-expanded boxes
+	int memoryBudgetMB = 0;			// run memory, models excluded: tiles or caps det, caps rec batch and width, and caps the one
+									// process-wide ORT arena all models share (last set wins), so per model only the input caps apply, 0 = off
+	float recFallbackScore = 0.0f;	// lines below this mean confidence are re-read by the fallback recognizer, 0 = off
+	float recFallbackMinScore = 0.0f;	// same for the lowest character confidence of a line
+	int recScript = -1;				// default recognizer for lines without a per-call hint, 0 = primary, n = the n-th added one, -1 = script classifier
+	float recTallRatio = 0.0f;		// crops this many times taller than wide are turned 90° before rec, 0 = off
+	float directionMinScore = 0.9f;	// direction classifier confidence needed to flip a crop 180°
+	bool fuseModels = false;		// models are rewritten at load to take uint8 pixels, det returns an 8-bit map and rec its argmax
+};
+
+struct QiOcrStats
+{
+	unsigned int size = sizeof(QiOcrStats);	// set by the caller's header, the library writes only this much
+	unsigned long long recRejected = 0;	// det crops dropped before recognition
+	unsigned long long recLines = 0;		// lines the primary recognizer read
+	unsigned long long recEscalated = 0;	// of those, lines re-read by the fallback
+	unsigned long long recRotated = 0;		// crop rotations before rec, 90° and 180° counted separately
+	unsigned long long recCacheHits = 0;			// summed over the primary, fallback and script recognizers
+	unsigned long long recCacheMisses = 0;
+	unsigned long long detPixelsSkipped = 0;	// input pixels that did not go through det
+	unsigned long long detRejected = 0;		// frames the det pre-pass found no text-like tile in
+	unsigned long long peakWorkingSet = 0;	// process memory high-water mark, in bytes
+};
+
+struct QiOcrBox
+{
+	RECT rect;
+	float score;
+};
+
+struct QiOcrRoiMode
+{
+	enum
+	{
+		roi_line,
+		roi_detect
+	};
+};
+
+using QiOcrWatchCallback = void(*)(int id, const char* text, void* user);
+
 struct QiOcrInterface
 {
 	virtual std::vector<std::string> scan_list(const CImage& image, bool skipDet = false) = 0;
 	virtual std::vector<std::string> scan_list(const RECT& rect_screen, bool skipDet = false) = 0;
 	virtual std::string scan(const CImage& image, bool skipDet = false) = 0;
 	virtual std::string scan(const RECT& rect_screen, bool skipDet = false) = 0;
+	virtual void set_config(const QiOcrConfig& config) = 0;
+	// fields past config.size / stats.size are left alone, set_config keeps the current value of the missing ones
+	virtual void get_config(QiOcrConfig& config) = 0;
+	virtual void get_stats(QiOcrStats& stats) = 0;
+	virtual int watch(const RECT& rect_screen, unsigned int interval, QiOcrWatchCallback callback, void* user = nullptr) = 0;
+	virtual void unwatch(int id) = 0;
+	virtual std::vector<QiOcrBox> detect(const CImage& image) = 0;
+	virtual std::vector<QiOcrBox> detect(const RECT& rect_screen) = 0;
+	virtual bool has_text(const CImage& image) = 0;
+	virtual bool has_text(const RECT& rect_screen) = 0;
+	virtual std::string scan_point(const POINT& point_screen, int radius = 0, const char* charset = nullptr, int script = -1) = 0;
+	virtual std::string scan_point(const CImage& image, const POINT& point, int radius = 0, const char* charset = nullptr, int script = -1) = 0;
+	// charsets and scripts are null or hold one entry per rect
+	virtual std::vector<std::string> scan_rois(const CImage& image, const RECT* rects, size_t count, int mode = QiOcrRoiMode::roi_line, const char* const* charsets = nullptr, const int* scripts = nullptr) = 0;
+	virtual bool is_init() = 0;
+	virtual bool set_fallback(const char* model_file) = 0;
+	virtual bool set_fallback(void* recData, size_t recSize) = 0;
+	// script routing: a script argument (-1 = none) picks the recognizer for a call or rect, 0 = primary,
+	// n = the n-th add_recognizer; lines without one follow recScript, then the script classifier. There is
+	// no built-in classifier: set_script_classifier takes a caller-trained model whose class n means
+	// recognizer n. Without a hint or a classifier every line goes to the primary
+	virtual int add_recognizer(const char* model_file, const char* keys_file) = 0;
+	virtual int add_recognizer(void* recData, size_t recSize, void* keysData, size_t keysSize) = 0;
+	virtual bool set_script_classifier(const char* model_file) = 0;
+	virtual bool set_script_classifier(void* clsData, size_t clsSize) = 0;
+	virtual bool set_direction_classifier(const char* model_file) = 0;
+	virtual bool set_direction_classifier(void* clsData, size_t clsSize) = 0;
+	// scan_list and scan restricted to the UTF-8 characters of charset, matched against the keys of the recognizer each
+	// line is routed to, nullptr = all keys
+	virtual std::vector<std::string> scan_list_ex(const CImage& image, bool skipDet = false, const char* charset = nullptr, int script = -1) = 0;
+	virtual std::vector<std::string> scan_list_ex(const RECT& rect_screen, bool skipDet = false, const char* charset = nullptr, int script = -1) = 0;
+	virtual std::string scan_ex(const CImage& image, bool skipDet = false, const char* charset = nullptr, int script = -1) = 0;
+	virtual std::string scan_ex(const RECT& rect_screen, bool skipDet = false, const char* charset = nullptr, int script = -1) = 0;
 };
 
 using PFQiOcrInterfaceInit = QiOcrInterface*(*)();
 using PFQiOcrInterfaceInitFromMemory = QiOcrInterface * (*)(void*, size_t, void*, size_t, void*, size_t);
+using PFQiOcrInterfaceInitEx = QiOcrInterface*(*)(const QiOcrConfig*);
+using PFQiOcrInterfaceInitFromMemoryEx = QiOcrInterface * (*)(void*, size_t, void*, size_t, void*, size_t, const QiOcrConfig*);
 
 #ifdef QIOCR_SHARED
-inline QiOcrInterface* QiOcrInterfaceInit()
+inline QiOcrInterface* QiOcrInterfaceInit(const QiOcrConfig* config = nullptr)
 {
 	HMODULE hModule = LoadLibraryW(L"qiocr.dll");
 	if (!hModule)
@@ -32,13 +145,18 @@ inline QiOcrInterface* QiOcrInterfaceInit()
 		hModule = LoadLibraryW(L"OCR\\qiocr.dll");
 		if (!hModule) return nullptr;
 	}
-	PFQiOcrInterfaceInit pFunction = (PFQiOcrInterfaceInit)GetProcAddress(hModule, "QiOcrInterfaceInitInterface");
-	if (!pFunction)
+	// without a config the original export is used, so an older dll still loads
+	QiOcrInterface* pInterface = nullptr;
+	if (config)
 	{
-		FreeLibrary(hModule);
-		return nullptr;
+		PFQiOcrInterfaceInitEx pFunction = (PFQiOcrInterfaceInitEx)GetProcAddress(hModule, "QiOcrInterfaceInitInterfaceEx");
+		if (pFunction) pInterface = pFunction(config);
+	}
+	else
+	{
+		PFQiOcrInterfaceInit pFunction = (PFQiOcrInterfaceInit)GetProcAddress(hModule, "QiOcrInterfaceInitInterface");
+		if (pFunction) pInterface = pFunction();
 	}
-	QiOcrInterface* pInterface = pFunction();
 	if (!pInterface)
 	{
 		FreeLibrary(hModule);
@@ -46,7 +164,7 @@ inline QiOcrInterface* QiOcrInterfaceInit()
 	}
 	return pInterface;
 }
-inline QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize)
+inline QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize, const QiOcrConfig* config = nullptr)
 {
 	HMODULE hModule = LoadLibraryW(L"qiocr.dll");
 	if (!hModule)
@@ -54,13 +172,17 @@ inline QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* k
 		hModule = LoadLibraryW(L"OCR\\qiocr.dll");
 		if (!hModule) return nullptr;
 	}
-	PFQiOcrInterfaceInitFromMemory pFunction = (PFQiOcrInterfaceInitFromMemory)GetProcAddress(hModule, "QiOcrInterfaceInitInterfaceFromMemory");
-	if (!pFunction)
+	QiOcrInterface* pInterface = nullptr;
+	if (config)
 	{
-		FreeLibrary(hModule);
-		return nullptr;
+		PFQiOcrInterfaceInitFromMemoryEx pFunction = (PFQiOcrInterfaceInitFromMemoryEx)GetProcAddress(hModule, "QiOcrInterfaceInitInterfaceFromMemoryEx");
+		if (pFunction) pInterface = pFunction(recData, recSize, keysData, keysSize, detData, detSize, config);
+	}
+	else
+	{
+		PFQiOcrInterfaceInitFromMemory pFunction = (PFQiOcrInterfaceInitFromMemory)GetProcAddress(hModule, "QiOcrInterfaceInitInterfaceFromMemory");
+		if (pFunction) pInterface = pFunction(recData, recSize, keysData, keysSize, detData, detSize);
 	}
-	QiOcrInterface* pInterface = pFunction(recData, recSize, keysData, keysSize, detData, detSize);
 	if (!pInterface)
 	{
 		FreeLibrary(hModule);
@@ -69,6 +191,6 @@ inline QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* k
 	return pInterface;
 }
 #else
-QiOcrInterface* QiOcrInterfaceInit();
-QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize);
+QiOcrInterface* QiOcrInterfaceInit(const QiOcrConfig* config = nullptr);
+QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize, const QiOcrConfig* config = nullptr);
 #endif
\ No newline at end of file
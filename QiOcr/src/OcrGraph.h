@@ -0,0 +1,350 @@
+﻿#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// rewrites the det and rec onnx graphs so they take uint8 BGR NHWC pixels and, for rec, also return
+// the per-timestep argmax, the runtime picks these variants up by their input type and output names.
+// only the handful of onnx.proto fields the rewrite touches are decoded, everything else is copied
+// through byte for byte
+class OcrGraph
+{
+public:
+	static constexpr const char* s_pixelsName = "ocr_pixels";
+	static constexpr const char* s_indexName = "ocr_index";
+	static constexpr const char* s_scoreName = "ocr_score";
+	static constexpr const char* s_probName = "ocr_prob_u8";
+
+	// det output becomes the text probability scaled to 0..255 as uint8, empty on failure
+	static std::string fuseDet(const std::string& model)
+	{
+		return fuse(model, false);
+	}
+	// rec keeps its logits output and gains ocr_index (int64) and ocr_score (float) per timestep, empty on failure
+	static std::string fuseRec(const std::string& model)
+	{
+		return fuse(model, true);
+	}
+
+private:
+	struct Field
+	{
+		uint32_t number;
+		uint32_t wire;
+		uint64_t value;
+		std::string bytes;
+	};
+	using Fields = std::vector<Field>;
+
+	// onnx.proto field numbers
+	enum
+	{
+		model_opset_import = 8,
+		model_graph = 7,
+		opset_domain = 1,
+		opset_version = 2,
+		graph_node = 1,
+		graph_initializer = 5,
+		graph_input = 11,
+		graph_output = 12,
+		node_input = 1,
+		node_output = 2,
+		node_name = 3,
+		node_op_type = 4,
+		node_attribute = 5,
+		attribute_name = 1,
+		attribute_i = 3,
+		attribute_ints = 8,
+		attribute_type = 20,
+		tensor_dims = 1,
+		tensor_data_type = 2,
+		tensor_name = 8,
+		tensor_raw_data = 9,
+		value_name = 1,
+		value_type = 2,
+		type_tensor = 1,
+		tensor_type_elem = 1,
+		tensor_type_shape = 2,
+		shape_dim = 1,
+		dim_value = 1,
+		dim_param = 2
+	};
+	enum
+	{
+		type_float = 1,
+		type_uint8 = 2,
+		type_int64 = 7
+	};
+	enum
+	{
+		attribute_int = 2,
+		attribute_int_list = 7
+	};
+
+	static bool readVarint(const std::string& data, size_t& pos, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64 && pos < data.size(); shift += 7)
+		{
+			uint8_t byte = static_cast<uint8_t>(data[pos++]);
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	static bool parse(const std::string& data, Fields& fields)
+	{
+		size_t pos = 0;
+		while (pos < data.size())
+		{
+			uint64_t key;
+			if (!readVarint(data, pos, key)) return false;
+			Field field = { static_cast<uint32_t>(key >> 3), static_cast<uint32_t>(key & 7), 0, std::string() };
+			switch (field.wire)
+			{
+			case 0:
+				if (!readVarint(data, pos, field.value)) return false;
+				break;
+			case 1:
+				if (data.size() - pos < 8) return false;
+				memcpy(&field.value, &data[pos], 8);
+				pos += 8;
+				break;
+			case 2:
+			{
+				uint64_t length;
+				if (!readVarint(data, pos, length) || length > data.size() - pos) return false;
+				field.bytes = data.substr(pos, static_cast<size_t>(length));
+				pos += static_cast<size_t>(length);
+				break;
+			}
+			case 5:
+			{
+				if (data.size() - pos < 4) return false;
+				uint32_t value;
+				memcpy(&value, &data[pos], 4);
+				field.value = value;
+				pos += 4;
+				break;
+			}
+			default:
+				return false;
+			}
+			fields.push_back(std::move(field));
+		}
+		return true;
+	}
+
+	static void writeVarint(std::string& out, uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out += static_cast<char>((value & 0x7F) | 0x80);
+			value >>= 7;
+		}
+		out += static_cast<char>(value);
+	}
+
+	static std::string serialize(const Fields& fields)
+	{
+		std::string out;
+		for (const Field& field : fields)
+		{
+			writeVarint(out, (static_cast<uint64_t>(field.number) << 3) | field.wire);
+			if (field.wire == 0) writeVarint(out, field.value);
+			else if (field.wire == 1) out.append(reinterpret_cast<const char*>(&field.value), 8);
+			else if (field.wire == 5)
+			{
+				uint32_t value = static_cast<uint32_t>(field.value);
+				out.append(reinterpret_cast<const char*>(&value), 4);
+			}
+			else
+			{
+				writeVarint(out, field.bytes.size());
+				out += field.bytes;
+			}
+		}
+		return out;
+	}
+
+	static Field bytes(uint32_t number, const std::string& value)
+	{
+		return { number, 2, 0, value };
+	}
+	static Field varint(uint32_t number, uint64_t value)
+	{
+		return { number, 0, value, std::string() };
+	}
+	static const Field* find(const Fields& fields, uint32_t number)
+	{
+		for (const Field& field : fields) if (field.number == number) return &field;
+		return nullptr;
+	}
+	static std::string name(const std::string& message)
+	{
+		Fields fields;
+		if (!parse(message, fields)) return std::string();
+		const Field* field = find(fields, value_name);
+		return field ? field->bytes : std::string();
+	}
+
+	static Field attribute(const std::string& name, int64_t value)
+	{
+		return bytes(node_attribute, serialize({ bytes(attribute_name, name), varint(attribute_i, static_cast<uint64_t>(value)), varint(attribute_type, attribute_int) }));
+	}
+	static Field attribute(const std::string& name, const std::vector<int64_t>& values)
+	{
+		Fields fields = { bytes(attribute_name, name) };
+		for (int64_t value : values) fields.push_back(varint(attribute_ints, static_cast<uint64_t>(value)));
+		fields.push_back(varint(attribute_type, attribute_int_list));
+		return bytes(node_attribute, serialize(fields));
+	}
+
+	static Field node(const std::string& opType, const std::vector<std::string>& inputs, const std::string& output, const Fields& attributes = Fields())
+	{
+		Fields fields;
+		for (const std::string& input : inputs) fields.push_back(bytes(node_input, input));
+		fields.push_back(bytes(node_output, output));
+		fields.push_back(bytes(node_name, output));
+		fields.push_back(bytes(node_op_type, opType));
+		fields.insert(fields.end(), attributes.begin(), attributes.end());
+		return bytes(graph_node, serialize(fields));
+	}
+
+	static Field initializer(const std::string& name, int type, const std::vector<int64_t>& dims, const void* data, size_t size)
+	{
+		Fields fields;
+		for (int64_t dim : dims) fields.push_back(varint(tensor_dims, static_cast<uint64_t>(dim)));
+		fields.push_back(varint(tensor_data_type, type));
+		fields.push_back(bytes(tensor_name, name));
+		fields.push_back(bytes(tensor_raw_data, std::string(static_cast<const char*>(data), size)));
+		return bytes(graph_initializer, serialize(fields));
+	}
+
+	// a tensor value info, dims holds serialized TensorShapeProto.Dimension messages, none = unknown shape
+	static Field valueInfo(uint32_t number, const std::string& name, int type, const std::vector<std::string>& dims)
+	{
+		Fields tensor = { varint(tensor_type_elem, type) };
+		if (!dims.empty())
+		{
+			Fields shape;
+			for (const std::string& dim : dims) shape.push_back(bytes(shape_dim, dim));
+			tensor.push_back(bytes(tensor_type_shape, serialize(shape)));
+		}
+		Fields typeFields = { bytes(type_tensor, serialize(tensor)) };
+		return bytes(number, serialize({ bytes(value_name, name), bytes(value_type, serialize(typeFields)) }));
+	}
+
+	// the Dimension messages of a tensor value info, empty when the shape is not a 4d tensor
+	static std::vector<std::string> dims(const std::string& info)
+	{
+		std::vector<std::string> result;
+		Fields fields, typeFields, tensor, shape;
+		if (!parse(info, fields)) return result;
+		const Field* typeField = find(fields, value_type);
+		if (!typeField || !parse(typeField->bytes, typeFields)) return result;
+		const Field* tensorField = find(typeFields, type_tensor);
+		if (!tensorField || !parse(tensorField->bytes, tensor)) return result;
+		const Field* shapeField = find(tensor, tensor_type_shape);
+		if (!shapeField || !parse(shapeField->bytes, shape)) return result;
+		for (const Field& dim : shape) if (dim.number == shape_dim) result.push_back(dim.bytes);
+		if (result.size() != 4) result.clear();
+		return result;
+	}
+	static std::string dimension(const std::string& param)
+	{
+		return serialize({ bytes(dim_param, param) });
+	}
+	static std::string dimension(int64_t value)
+	{
+		return serialize({ varint(dim_value, static_cast<uint64_t>(value)) });
+	}
+
+	static int64_t opsetVersion(const Fields& model)
+	{
+		for (const Field& field : model)
+		{
+			if (field.number != model_opset_import) continue;
+			Fields opset;
+			if (!parse(field.bytes, opset)) continue;
+			const Field* domain = find(opset, opset_domain);
+			const Field* version = find(opset, opset_version);
+			if ((!domain || domain->bytes.empty() || domain->bytes == "ai.onnx") && version) return static_cast<int64_t>(version->value);
+		}
+		return 0;
+	}
+
+	static std::string fuse(const std::string& model, bool rec)
+	{
+		Fields modelFields, graph;
+		if (!parse(model, modelFields)) return std::string();
+		auto graphField = modelFields.end();
+		for (auto i = modelFields.begin(); i != modelFields.end(); i++) if (i->number == model_graph) graphField = i;
+		if (graphField == modelFields.end() || !parse(graphField->bytes, graph)) return std::string();
+
+		const Field* input = find(graph, graph_input);
+		const Field* output = find(graph, graph_output);
+		if (!input || !output) return std::string();
+		std::string inputName = name(input->bytes);
+		std::string outputName = name(output->bytes);
+		if (inputName.empty() || outputName.empty() || inputName == s_pixelsName) return std::string();
+
+		// pixels (N,H,W,3 BGR uint8) -> RGB -> float -> (x - 127.5) / 127.5 -> N,3,H,W under the old input name
+		std::vector<std::string> inputDims = dims(input->bytes);
+		std::vector<std::string> pixelDims = inputDims.empty()
+			? std::vector<std::string>{ dimension("N"), dimension("H"), dimension("W"), dimension(3) }
+			: std::vector<std::string>{ inputDims[0], inputDims[2], inputDims[3], dimension(3) };
+		const int64_t channelOrder[] = { 2, 1, 0 };
+		const float mean = 127.5f;
+		const float scale = 1.0f / 127.5f;
+		Fields before = {
+			initializer("ocr_channel_order", type_int64, { 3 }, channelOrder, sizeof(channelOrder)),
+			initializer("ocr_mean", type_float, {}, &mean, sizeof(mean)),
+			initializer("ocr_scale", type_float, {}, &scale, sizeof(scale)),
+			node("Gather", { s_pixelsName, "ocr_channel_order" }, "ocr_rgb", { attribute("axis", (int64_t)3) }),
+			node("Cast", { "ocr_rgb" }, "ocr_float", { attribute("to", (int64_t)type_float) }),
+			node("Sub", { "ocr_float", "ocr_mean" }, "ocr_centered"),
+			node("Mul", { "ocr_centered", "ocr_scale" }, "ocr_normalized"),
+			node("Transpose", { "ocr_normalized" }, inputName, { attribute("perm", std::vector<int64_t>{ 0, 3, 1, 2 }) }),
+			valueInfo(graph_input, s_pixelsName, type_uint8, pixelDims)
+		};
+
+		Fields after;
+		if (rec)
+		{
+			after.push_back(node("ArgMax", { outputName }, s_indexName, { attribute("axis", (int64_t)2), attribute("keepdims", (int64_t)0) }));
+			if (opsetVersion(modelFields) >= 18)
+			{
+				const int64_t axes[] = { 2 };
+				after.push_back(initializer("ocr_axes", type_int64, { 1 }, axes, sizeof(axes)));
+				after.push_back(node("ReduceMax", { outputName, "ocr_axes" }, s_scoreName, { attribute("keepdims", (int64_t)0) }));
+			}
+			else after.push_back(node("ReduceMax", { outputName }, s_scoreName, { attribute("axes", std::vector<int64_t>{ 2 }), attribute("keepdims", (int64_t)0) }));
+			after.push_back(valueInfo(graph_output, s_indexName, type_int64, {}));
+			after.push_back(valueInfo(graph_output, s_scoreName, type_float, {}));
+		}
+		else
+		{
+			const float full = 255.0f;
+			after.push_back(initializer("ocr_full", type_float, {}, &full, sizeof(full)));
+			after.push_back(node("Mul", { outputName, "ocr_full" }, "ocr_prob_scaled"));
+			after.push_back(node("Cast", { "ocr_prob_scaled" }, s_probName, { attribute("to", (int64_t)type_uint8) }));
+			after.push_back(valueInfo(graph_output, s_probName, type_uint8, {}));
+		}
+
+		// nodes stay topologically sorted: the input chain goes first and the output ops last
+		Fields fused = before;
+		for (const Field& field : graph)
+		{
+			if (field.number == graph_input && name(field.bytes) == inputName) continue;
+			if (!rec && field.number == graph_output && name(field.bytes) == outputName) continue;
+			fused.push_back(field);
+		}
+		fused.insert(fused.end(), after.begin(), after.end());
+
+		graphField->bytes = serialize(fused);
+		return serialize(modelFields);
+	}
+};
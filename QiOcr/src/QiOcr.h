@@ -1,20 +1,38 @@
 ﻿#pragma once
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <map>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <unordered_map>
 #include <memory>
 #include <numeric>
 #include <sstream>
 #include <fstream>
 #include <windows.h>
+#include <psapi.h>
 #include <atlimage.h>
+#include <QiOcrInterface.h>
+#include "OcrGraph.h"
 
 #include <onnxruntime_cxx_api.h>
+#include <onnxruntime_run_options_config_keys.h>
+#include <onnxruntime_session_options_config_keys.h>
 #pragma comment(lib,"onnxruntime.lib")
 
 #include <opencv2/opencv.hpp>
 #pragma comment(lib,"opencv_core4110.lib")
 #pragma comment(lib,"opencv_imgproc4110.lib")
 #pragma comment(lib,"zlib.lib")
+#pragma comment(lib,"psapi.lib")
 
 #ifndef AlignmentSize
 #define AlignmentSize(size, alignment) ((alignment > 1) ? ((size%alignment) ? (size+(alignment-(size%alignment))) : size) : size)
@@ -33,16 +51,77 @@ struct OnnxOcrResult
 	};
 };
 
+struct OcrBox
+{
+	cv::Rect rect;
+	float score;
+};
+
+struct OcrText
+{
+	std::string text;
+	float score = 0.0f;
+	float minScore = 0.0f;
+};
+
 class OcrBase
 {
 protected:
 	static constexpr float s_meanValue = 127.5f;
 	static constexpr float s_normValue = 1.0 / s_meanValue;
-	std::unique_ptr<Ort::Env> m_env;
+	static constexpr size_t s_hotShapeCount = 3;
+	struct Geometry
+	{
+		std::vector<int64_t> inputShape;
+		std::vector<int64_t> outputShape;
+		std::vector<float> input;
+		std::vector<float> output;
+		std::vector<uchar> pixels;
+		std::vector<uchar> bytes;
+		Ort::IoBinding binding{ nullptr };
+		Ort::Value boundInput{ nullptr };
+		Ort::Value boundOutput{ nullptr };
+		Ort::Session* bound = nullptr;
+		cv::Mat scaled;
+		cv::Mat scratch;
+	};
+	Ort::Env* m_env = nullptr;
 	std::unique_ptr<Ort::Session> m_session;
+	std::map<std::vector<int64_t>, std::unique_ptr<Ort::Session>> m_shapeSessions;
+	std::map<std::vector<int64_t>, size_t> m_shapeHits;
+	std::list<Geometry> m_geometries;
+	std::vector<std::string> m_inputDims;
+	std::vector<int64_t> m_inputShape;
+	std::vector<std::string> m_outputNames;
+	std::vector<char> m_model;
+	size_t m_shapeSessionsMax = 0;
+	size_t m_geometryMax = 0;
+	size_t m_shrinkElements = 0;
+	size_t m_threads = 1;
+	std::string m_logId;
 	char* m_inputName = nullptr;
 	char* m_outputName = nullptr;
 	bool m_init = false;
+	bool m_trimPending = false;
+	bool m_pixelInput = false;
+	bool m_fuse = false;
+	// ort keeps one env per process, so every model shares it and the one allocator registered on it
+	struct SharedEnv
+	{
+		std::mutex mutex;
+		std::unique_ptr<Ort::Env> env;
+		size_t arenaBytes = 0;
+	};
+	static SharedEnv& shared()
+	{
+		static SharedEnv env;
+		return env;
+	}
+	struct TrimScope
+	{
+		OcrBase* base;
+		~TrimScope() { base->trim(); }
+	};
 public:
 	static std::string toString(std::wstring val, UINT codePage = CP_UTF8)
 	{
@@ -66,6 +145,25 @@ public:
 		}
 		return std::wstring();
 	}
+	static uint64_t hashImage(const cv::Mat& image, uint64_t seed = 0)
+	{
+		uint64_t hash = seed ^ 0x9E3779B97F4A7C15ull ^ ((uint64_t)image.cols << 32) ^ ((uint64_t)image.rows << 8) ^ (uint64_t)image.type();
+		size_t rowBytes = image.cols * image.elemSize();
+		for (int y = 0; y < image.rows; y++)
+		{
+			const uchar* row = image.ptr<uchar>(y);
+			size_t i = 0;
+			for (; i + 8 <= rowBytes; i += 8)
+			{
+				uint64_t word;
+				memcpy(&word, row + i, 8);
+				hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+				hash ^= hash >> 32;
+			}
+			for (; i < rowBytes; i++) hash = (hash ^ row[i]) * 0x100000001B3ull;
+		}
+		return hash ^ (hash >> 29);
+	}
 	static bool readFile(const std::string& file, std::unique_ptr<char[]>& data, size_t& size)
 	{
 		std::ifstream modelFile(file, std::ios::in | std::ios::binary | std::ios::ate);
@@ -91,6 +189,15 @@ public:
 	virtual void release()
 	{
 		m_init = false;
+		m_pixelInput = false;
+		m_outputNames.clear();
+		m_geometries.clear();
+		m_shapeSessions.clear();
+		m_shapeHits.clear();
+		m_inputDims.clear();
+		m_inputShape.clear();
+		m_model.clear();
+		m_session.reset();
 		if (m_inputName)
 		{
 			free(m_inputName);
@@ -102,220 +209,129 @@ public:
 			m_outputName = nullptr;
 		}
 	}
-	virtual std::vector<float> makeTensorValues(const cv::Mat& src)
+	void setShapeSessions(size_t count)
 	{
-		if (src.empty()) return std::vector<float>();
-
-		int width = src.cols;
-		int height = src.rows;
-		int numChannels = src.channels();
-
-		if (numChannels < 3)
+		m_shapeSessionsMax = count;
+		if (m_shapeSessions.size() > count)
 		{
-			cv::Mat bgrImage;
-			cv::cvtColor(src, bgrImage, cv::COLOR_GRAY2BGR);
-			return makeTensorValues(bgrImage);
-		}
-
-		size_t imageSize = width * height;
-		std::vector<float> inputTensorValues(imageSize * 3);
-
-		cv::Mat bgrImage;
-		if (numChannels == 4) cv::cvtColor(src, bgrImage, cv::COLOR_BGRA2BGR);
-		else bgrImage = src;
-
-		for (int y = 0; y < height; ++y) {
-			const cv::Vec3b* row = bgrImage.ptr<cv::Vec3b>(y);
-			for (int x = 0; x < width; ++x) {
-				const cv::Vec3b& pixel = row[x];
-
-				BYTE blue = pixel[0];
-				BYTE green = pixel[1];
-				BYTE red = pixel[2];
-
-				float normRed = (static_cast<float>(red) - s_meanValue) * s_normValue;
-				float normGreen = (static_cast<float>(green) - s_meanValue) * s_normValue;
-				float normBlue = (static_cast<float>(blue) - s_meanValue) * s_normValue;
-
-				size_t index = y * width + x;
-				inputTensorValues[index] = normRed;
-				inputTensorValues[imageSize + index] = normGreen;
-				inputTensorValues[2 * imageSize + index] = normBlue;
-			}
+			m_geometries.clear();
+			m_shapeSessions.clear();
 		}
-
-		return inputTensorValues;
 	}
-};
-
-class OcrDet : public OcrBase
-{
-public:
-	int init(void* modelData, size_t modelSize, size_t threads = 2)
+	void setGeometryCache(size_t count)
 	{
-		OcrBase::release();
-		if (!threads) threads = 1;
-
-		if (!Ort::Global<void>::api_) return OnnxOcrResult::r_sdk_different;
-		try
-		{
-			m_env = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_ERROR, "OnnxOcrDet");
-		}
-		catch (...)
+		m_geometryMax = count;
+		while (m_geometries.size() > count) m_geometries.pop_back();
+	}
+	void setArenaShrink(size_t elements)
+	{
+		m_shrinkElements = elements;
+	}
+	static Ort::Env* env()
+	{
+		SharedEnv& s = shared();
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if (!s.env)
 		{
-			return OnnxOcrResult::r_sdk_different;
+			try
+			{
+				s.env = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_ERROR, "QiOcr");
+			}
+			catch (...)
+			{
+				return nullptr;
+			}
 		}
+		return s.env.get();
+	}
+	// caps the arena of every session of the process created afterwards, 0 = uncapped; ort takes a single
+	// allocator per memory info, so this is one cap over all models together and not a per model share
+	static bool setEnvArena(size_t bytes)
+	{
+		Ort::Env* ortEnv = env();
+		if (!ortEnv) return false;
+		SharedEnv& s = shared();
+		std::lock_guard<std::mutex> lock(s.mutex);
+		if (s.arenaBytes == bytes) return true;
 		try
 		{
-			Ort::SessionOptions options;
-			options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-			options.SetInterOpNumThreads(threads);
-
-			m_session = std::make_unique<Ort::Session>(*m_env, modelData, modelSize, options);
-
-			size_t inputCount = m_session->GetInputCount();
-			if (!inputCount) return OnnxOcrResult::r_model_invalid;
-
-			Ort::AllocatorWithDefaultOptions allocator;
-			Ort::AllocatedStringPtr s = m_session->GetInputNameAllocated(0, allocator);
-			m_inputName = strdup(s.get());
-
-			s = m_session->GetOutputNameAllocated(0, allocator);
-			m_outputName = strdup(s.get());
+			// running sessions keep their reference to the previous allocator
+			Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+			if (s.arenaBytes) Ort::ThrowOnError(Ort::GetApi().UnregisterAllocator(*ortEnv, memoryInfo));
+			s.arenaBytes = 0;
+			if (bytes)
+			{
+				Ort::ArenaCfg arenaCfg(bytes, 1, -1, -1);
+				ortEnv->CreateAndRegisterAllocator(memoryInfo, arenaCfg);
+				s.arenaBytes = bytes;
+			}
+			return true;
 		}
 		catch (...)
 		{
-			return OnnxOcrResult::r_model_invalid;
+			return false;
 		}
-
-		m_init = true;
-		return OnnxOcrResult::r_ok;
 	}
-	int init(const std::string& model, size_t threads = 2)
+	static bool envArena()
 	{
-		size_t modelSize;
-		std::unique_ptr<char[]> modelData;
-		if (!readFile(model, modelData, modelSize)) return OnnxOcrResult::r_model_notfound;
-
-		return init(modelData.get(), modelSize, threads);
+		SharedEnv& s = shared();
+		std::lock_guard<std::mutex> lock(s.mutex);
+		return s.arenaBytes != 0;
+	}
+	// takes effect for models loaded afterwards
+	void setFuse(bool fuse)
+	{
+		m_fuse = fuse;
+	}
+	bool hasOutput(const char* name) const
+	{
+		return std::find(m_outputNames.begin(), m_outputNames.end(), name) != m_outputNames.end();
 	}
 
-	std::vector<cv::Mat> scan(const cv::Mat& image, float margin_ratio = 1.0f)
+	// drops the buffers of runs above the shrink size once their results have been read
+	void trim()
 	{
-		if (!isInit()) return std::vector<cv::Mat>();
-		if (image.empty()) return std::vector<cv::Mat>();
-		if (image.channels() < 3) return std::vector<cv::Mat>();
+		if (!m_trimPending) return;
+		m_trimPending = false;
+		m_geometries.remove_if([this](const Geometry& g) { return elements(g) > m_shrinkElements; });
+	}
 
-		cv::Mat imageScaled = resizeImage(image, 32);
-		std::vector<float> tensorValues = OcrBase::makeTensorValues(imageScaled);
-		std::vector<int64_t> inputShape{ 1, 3, imageScaled.rows, imageScaled.cols };
+	// releases the sessions and buffers but keeps the model, the next run reloads it
+	void unload()
+	{
+		if (!m_session) return;
+		m_geometries.clear();
+		m_shapeSessions.clear();
+		m_shapeHits.clear();
+		m_session.reset();
+	}
+	bool reload()
+	{
+		if (m_session) return true;
+		if (!m_init) return false;
 		try
 		{
-			Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-
-			Ort::Value inputTensor = Ort::Value::CreateTensor<float>(memoryInfo, tensorValues.data(), tensorValues.size(), inputShape.data(), inputShape.size());
-			if (!inputTensor.IsTensor()) return std::vector<cv::Mat>();
-
-			std::vector<Ort::Value> outputTensor = m_session->Run(Ort::RunOptions{}, &m_inputName, &inputTensor, 1, &m_outputName, 1);
-			if (outputTensor.empty() || outputTensor.size() != 1 || !outputTensor.front().IsTensor()) return std::vector<cv::Mat>();
-
-			std::vector<int64_t> outputShape = outputTensor.front().GetTensorTypeAndShapeInfo().GetShape();
-			if (outputShape.size() != 4 || outputShape[0] != 1 || outputShape[1] != 1) return std::vector<cv::Mat>();
-
-			int64_t outputHeight = outputShape[2];
-			int64_t outputWidth = outputShape[3];
-			float* floatArray = outputTensor.front().GetTensorMutableData<float>();
-
-			cv::Mat outputMat(outputHeight, outputWidth, CV_32F, floatArray);
-
-			cv::Mat binaryMat;
-			double thresholdValue = 0.3;
-			cv::threshold(outputMat, binaryMat, thresholdValue, 1.0, cv::THRESH_BINARY);
-			binaryMat.convertTo(binaryMat, CV_8U, 255);
-
-			std::vector<std::vector<cv::Point>> contours;
-			cv::findContours(binaryMat, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
-
-			std::vector<cv::Rect> boxes;
-
-			for (const auto& contour : contours) {
-				cv::Rect rect = cv::boundingRect(contour);
-				if (rect.area() < 24) continue;
-
-				int margin = std::round(rect.height * margin_ratio);
-				int new_x = std::max(0, rect.x - margin);
-				int new_y = std::max(0, rect.y - margin);
-				int new_width = rect.width + 2 * margin;
-				int new_height = rect.height + 2 * margin;
-
-				new_width = std::min(new_width, imageScaled.cols - new_x);
-				new_height = std::min(new_height, imageScaled.rows - new_y);
-
-				if (new_width <= 0 || new_height <= 0) continue;
-
-				boxes.emplace_back(new_x, new_y, new_width, new_height);
-			}
-
-			std::vector<cv::Mat> regions;
-			for (std::vector<cv::Rect>::const_reverse_iterator i = boxes.rbegin(); i != boxes.rend(); i++)
-			{
-				const cv::Rect& rect = *i;
-				if (rect.width > 0 && rect.height > 0) regions.emplace_back(imageScaled(rect).clone());
-			}
-
-			return regions;
+			m_session = std::make_unique<Ort::Session>(*m_env, m_model.data(), m_model.size(), sessionOptions());
+			return true;
 		}
 		catch (...)
 		{
-			return std::vector<cv::Mat>();
+			return false;
 		}
 	}
 
-	static cv::Mat resizeImage(const cv::Mat& srcImage, size_t alignment = 32)
-	{
-		if (srcImage.empty()) return srcImage;
-
-		int dstWidth = AlignmentSize(srcImage.cols, alignment);
-		int dstHeight = AlignmentSize(srcImage.rows, alignment);
-
-		if (dstWidth == srcImage.cols && dstHeight == srcImage.rows) return srcImage.clone();
-
-		cv::Mat dstImage;
-		cv::resize(srcImage, dstImage, cv::Size(dstWidth, dstHeight), 0, 0, cv::INTER_LINEAR);
-
-		return dstImage;
-	}
-};
-
-class OcrRec : public OcrBase
-{
-	std::vector<std::string> m_keys;
-	size_t m_scaleSize = 48;
-public:
-	int init(void* modelData, size_t modelSize, const std::vector<std::string>& keys, size_t threads = 2, size_t scaleSize = 48)
+	int createSession(void* modelData, size_t modelSize, size_t threads, const char* logId)
 	{
 		OcrBase::release();
-		m_keys = keys;
-		m_scaleSize = scaleSize;
-		if (!threads) threads = 1;
-		if (m_keys.empty()) return OnnxOcrResult::r_keys_invalid;
+		m_threads = threads ? threads : 1;
+		m_logId = logId;
 
 		if (!Ort::Global<void>::api_) return OnnxOcrResult::r_sdk_different;
+		m_env = env();
+		if (!m_env) return OnnxOcrResult::r_sdk_different;
 		try
 		{
-			m_env = std::make_unique<Ort::Env>(ORT_LOGGING_LEVEL_ERROR, "OnnxOcrRec");
-		}
-		catch (...)
-		{
-			return OnnxOcrResult::r_sdk_different;
-		}
-		try
-		{
-			Ort::SessionOptions options;
-			options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-			options.SetInterOpNumThreads(threads);
-
-			m_session = std::make_unique<Ort::Session>(*m_env, modelData, modelSize, options);
+			m_session = std::make_unique<Ort::Session>(*m_env, modelData, modelSize, sessionOptions());
 
 			size_t inputCount = m_session->GetInputCount();
 			if (!inputCount) return OnnxOcrResult::r_model_invalid;
@@ -326,206 +342,2687 @@ public:
 
 			s = m_session->GetOutputNameAllocated(0, allocator);
 			m_outputName = strdup(s.get());
+			for (size_t i = 0; i < m_session->GetOutputCount(); i++) m_outputNames.push_back(m_session->GetOutputNameAllocated(i, allocator).get());
+
+			Ort::TypeInfo typeInfo = m_session->GetInputTypeInfo(0);
+			Ort::ConstTensorTypeAndShapeInfo shapeInfo = typeInfo.GetTensorTypeAndShapeInfo();
+			m_inputShape = shapeInfo.GetShape();
+			std::vector<const char*> dims(m_inputShape.size(), nullptr);
+			shapeInfo.GetSymbolicDimensions(dims.data(), dims.size());
+			for (size_t i = 0; i < m_inputShape.size(); i++) m_inputDims.push_back((m_inputShape[i] < 0 && dims[i]) ? dims[i] : "");
+
+			// fused models take uint8 NHWC pixels, m_inputShape stays NCHW like the float models
+			m_pixelInput = shapeInfo.GetElementType() == ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8;
+			if (m_pixelInput && m_inputShape.size() == 4) m_inputShape = { m_inputShape[0], m_inputShape[3], m_inputShape[1], m_inputShape[2] };
 		}
 		catch (...)
 		{
 			return OnnxOcrResult::r_model_invalid;
 		}
 
+		m_model.assign((const char*)modelData, (const char*)modelData + modelSize);
 		m_init = true;
 		return OnnxOcrResult::r_ok;
 	}
-	int init(void* modelData, size_t modelSize, void* keysData, size_t keysSize, size_t threads = 2, size_t scaleSize = 48)
-	{
-		std::istringstream keysDataStream(std::string((const char*)keysData, keysSize));
-		std::vector<std::string> keys;
-		std::string line;
-		while (std::getline(keysDataStream, line))
-		{
-			if (!line.empty() && line.back() == '\r') line.pop_back();
-			keys.push_back(line);
-		}
 
-		return init(modelData, modelSize, keys, threads, scaleSize);
-	}
-	int init(const std::string& model, const std::string& keys, size_t threads = 2, size_t scaleSize = 48)
+	Ort::SessionOptions sessionOptions() const
 	{
-		size_t modelSize;
-		std::unique_ptr<char[]> modelData;
-		if (!readFile(model, modelData, modelSize)) return OnnxOcrResult::r_model_notfound;
-
-		std::ifstream keysFile(keys);
-		if (!keysFile) return OnnxOcrResult::r_keys_notfound;
-		std::vector<std::string> keysData;
-		std::string line;
-		while (std::getline(keysFile, line))
-		{
-			if (!line.empty() && line.back() == '\r') line.pop_back();
-			keysData.push_back(line);
-		}
-
-		return init(modelData.get(), modelSize, keysData, threads, scaleSize);
+		Ort::SessionOptions options;
+		options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+		options.SetInterOpNumThreads(m_threads);
+		options.SetLogId(m_logId.c_str());
+		if (envArena()) options.AddConfigEntry(kOrtSessionOptionsConfigUseEnvAllocators, "1");
+		return options;
 	}
 
-	std::string scoreToString(const std::vector<float>& outputData, int h, int w)
+	Ort::Session& session(const std::vector<int64_t>& shape)
 	{
-		std::string result;
-		int indexPrev = 0;
-		for (int i = 0; i < h; i++) {
-			int firstChar = i * w;
-			int lastChar = i * w + w;
-			int index = std::distance(outputData.begin() + firstChar, std::max_element(outputData.begin() + firstChar, outputData.begin() + lastChar));
-			if (index > 0 && index <= m_keys.size() && index != indexPrev) result += m_keys[index - 1];
-			indexPrev = index;
-		}
-		return result;
-	}
+		if (!m_shapeSessionsMax || m_model.empty()) return *m_session;
 
-	std::string scan(const cv::Mat& image) {
-		if (!isInit()) return std::string();
-		if (image.empty()) return std::string();
-		if (image.channels() < 3) return std::string();
+		auto i = m_shapeSessions.find(shape);
+		if (i != m_shapeSessions.end()) return *i->second;
+		if (m_shapeSessions.size() >= m_shapeSessionsMax) return *m_session;
 
-		cv::Mat imageScaled = resizeWithHeight(image, m_scaleSize);
-		std::vector<float> tensorValues = OcrBase::makeTensorValues(imageScaled);
-		std::vector<int64_t> inputShape{ 1, 3, imageScaled.rows, imageScaled.cols };
+		if (m_shapeHits.size() > 64) m_shapeHits.clear();
+		if (++m_shapeHits[shape] < s_hotShapeCount) return *m_session;
+		m_shapeHits.erase(shape);
 
-		try
+		std::map<std::string, int64_t> overrides;
+		for (size_t d = 0; d < m_inputDims.size() && d < shape.size(); d++)
 		{
-			Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-
-			Ort::Value inputTensor = Ort::Value::CreateTensor<float>(memoryInfo, tensorValues.data(), tensorValues.size(), inputShape.data(), inputShape.size());
-			if (!inputTensor.IsTensor()) return std::string();
-
-			std::vector<Ort::Value> outputTensor = m_session->Run(Ort::RunOptions{}, &m_inputName, &inputTensor, 1, &m_outputName, 1);
-			if (outputTensor.empty() || outputTensor.size() != 1 || !outputTensor.front().IsTensor()) return std::string();
-
-			std::vector<int64_t> outputShape = outputTensor.front().GetTensorTypeAndShapeInfo().GetShape();
-			int64_t outputCount = std::accumulate(outputShape.begin(), outputShape.end(), 1, std::multiplies<int64_t>());
+			if (m_inputDims[d].empty()) continue;
+			auto r = overrides.emplace(m_inputDims[d], shape[d]);
+			if (!r.second && r.first->second != shape[d]) return *m_session;
+		}
+		if (overrides.empty()) return *m_session;
 
-			float* floatArray = outputTensor.front().GetTensorMutableData<float>();
-			return scoreToString(std::vector<float>(floatArray, floatArray + outputCount), outputShape[1], outputShape[2]);
+		try
+		{
+			Ort::SessionOptions options = sessionOptions();
+			for (const auto& o : overrides) Ort::ThrowOnError(Ort::GetApi().AddFreeDimensionOverrideByName(options, o.first.c_str(), o.second));
+			std::unique_ptr<Ort::Session>& specialized = m_shapeSessions[shape];
+			specialized = std::make_unique<Ort::Session>(*m_env, m_model.data(), m_model.size(), options);
+			return *specialized;
 		}
 		catch (...)
 		{
-			return std::string();
+			m_shapeSessions.erase(shape);
+			m_shapeSessionsMax = m_shapeSessions.size();
+			return *m_session;
 		}
 	}
 
-	static cv::Mat resizeWithHeight(const cv::Mat& srcImage, size_t height) {
-		double scaleFactor = static_cast<double>(height) / srcImage.rows;
-		int newWidth = static_cast<int>(srcImage.cols * scaleFactor);
-		cv::Mat destImage;
-		cv::resize(srcImage, destImage, cv::Size(newWidth, height), 0, 0, cv::INTER_LINEAR);
-		return destImage;
-	}
-};
-
-class QiOcrTool
-{
-	class OcrDet* det;
-	class OcrRec* rec;
-public:
-	QiOcrTool() : rec(new OcrRec), det(new OcrDet)
+	// shapes are given NCHW, pixel input models get the NHWC tensor shape
+	Geometry& geometry(const std::vector<int64_t>& shape)
 	{
-		SYSTEM_INFO info; GetSystemInfo(&info);
-		size_t threads = info.dwNumberOfProcessors >> 1;
-		if (threads < 2) threads = 2;
+		std::vector<int64_t> inputShape = (m_pixelInput && shape.size() == 4) ? std::vector<int64_t>{ shape[0], shape[2], shape[3], shape[1] } : shape;
+		if (!m_geometryMax) m_geometries.clear();
+		for (auto i = m_geometries.begin(); i != m_geometries.end(); i++)
+		{
+			if (i->inputShape != inputShape) continue;
+			m_geometries.splice(m_geometries.begin(), m_geometries, i);
+			return m_geometries.front();
+		}
 
-		if (!showResult(rec->init("OCR\\ppocr.onnx", "OCR\\ppocr.keys", threads, 48), L"OCR识别初始化错误")) return;
-		if (!showResult(det->init("OCR\\ppdet.onnx", threads), L"OCR检测初始化错误")) return;
+		m_geometries.emplace_front();
+		while (m_geometries.size() > std::max<size_t>(m_geometryMax, 1)) m_geometries.pop_back();
+
+		Geometry& g = m_geometries.front();
+		g.inputShape = inputShape;
+		if (m_pixelInput) g.pixels.assign(elements(g), 0);
+		else g.input.assign(elements(g), 0.0f);
+		return g;
 	}
-	QiOcrTool(void* recData, size_t recSize, void* keyData, size_t keySize, void* detData, size_t detSize) : rec(new OcrRec), det(new OcrDet)
+	static size_t elements(const Geometry& g)
 	{
-		SYSTEM_INFO info; GetSystemInfo(&info);
-		size_t threads = info.dwNumberOfProcessors >> 1;
-		if (threads < 2) threads = 2;
-
-		if (!showResult(rec->init(recData, recSize, keyData, keySize, threads, 48), L"OCR识别初始化错误")) return;
-		if (!showResult(det->init(detData, detSize, threads), L"OCR检测初始化错误")) return;
+		return (size_t)std::accumulate(g.inputShape.begin(), g.inputShape.end(), (int64_t)1, std::multiplies<int64_t>());
 	}
 
-	~QiOcrTool()
+	// writes one batch item, the float models get normalized planes and the fused ones the raw pixels
+	void fill(Geometry& g, size_t item, const cv::Mat& bgrImage, int tensorWidth)
 	{
-		delete rec;
-		delete det;
+		size_t itemSize = (size_t)tensorWidth * bgrImage.rows * 3;
+		if (!m_pixelInput)
+		{
+			fillTensorValues(bgrImage, g.input.data() + item * itemSize, tensorWidth);
+			return;
+		}
+
+		uchar* pixels = g.pixels.data() + item * itemSize;
+		size_t rowSize = (size_t)tensorWidth * 3;
+		size_t width = (size_t)std::min(bgrImage.cols, tensorWidth) * 3;
+		for (int y = 0; y < bgrImage.rows; y++)
+		{
+			uchar* row = pixels + y * rowSize;
+			memcpy(row, bgrImage.ptr<uchar>(y), width);
+			// 128 normalizes to the same near zero padding as the float path
+			memset(row + width, 128, rowSize - width);
+		}
 	}
 
-	bool showResult(int result, std::wstring title)
+	Ort::RunOptions makeRunOptions(const Geometry& g)
 	{
-		switch (result)
+		Ort::RunOptions options;
+		if (m_shrinkElements && elements(g) > m_shrinkElements)
 		{
-		case OnnxOcrResult::r_ok: return true;
-		case OnnxOcrResult::r_model_notfound: MessageBoxW(nullptr, L"模型不存在", title.c_str(), MB_ICONERROR); return false;
-		case OnnxOcrResult::r_keys_notfound: MessageBoxW(nullptr, L"Key不存在", title.c_str(), MB_ICONERROR); return false;
-		case OnnxOcrResult::r_model_invalid: MessageBoxW(nullptr, L"模型无效", title.c_str(), MB_ICONERROR); return false;
-		case OnnxOcrResult::r_keys_invalid: MessageBoxW(nullptr, L"Key无效", title.c_str(), MB_ICONERROR); return false;
-		case OnnxOcrResult::r_sdk_different: MessageBoxW(nullptr, L"Sdk不一致", title.c_str(), MB_ICONERROR); return false;
-		default: MessageBoxW(nullptr, L"未知错误", title.c_str(), MB_ICONERROR); return false;
+			options.AddConfigEntry(kOrtRunOptionsConfigEnableMemoryArenaShrinkage, "cpu:0");
+			m_trimPending = true;
 		}
+		return options;
+	}
+	Ort::Value makeInputTensor(Geometry& g, const Ort::MemoryInfo& memoryInfo)
+	{
+		if (m_pixelInput) return Ort::Value::CreateTensor<uint8_t>(memoryInfo, g.pixels.data(), g.pixels.size(), g.inputShape.data(), g.inputShape.size());
+		return Ort::Value::CreateTensor<float>(memoryInfo, g.input.data(), g.input.size(), g.inputShape.data(), g.inputShape.size());
 	}
 
-	bool isInit() const
+	// runs the named outputs without a binding, for the uint8 and multi output fused models
+	std::vector<Ort::Value> fetch(Geometry& g, const std::vector<const char*>& names)
 	{
-		return det->isInit() && rec->isInit();
+		if (!reload()) return std::vector<Ort::Value>();
+		Ort::Session& s = session(g.inputShape);
+		Ort::RunOptions options = makeRunOptions(g);
+		Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+		Ort::Value input = makeInputTensor(g, memoryInfo);
+		std::vector<Ort::Value> values = s.Run(options, &m_inputName, &input, 1, names.data(), names.size());
+		for (const Ort::Value& value : values) if (!value.IsTensor()) return std::vector<Ort::Value>();
+		return values;
 	}
 
-	std::vector<std::string> scan_list(const CImage& image, bool skipDet = false)
+	const float* run(Geometry& g)
 	{
-		if (!isInit()) return std::vector<std::string>();
-		cv::Mat mat = toMat(image);
-		if (mat.empty()) return std::vector<std::string>();
+		if (!reload()) return nullptr;
+		Ort::Session& s = session(g.inputShape);
 
-		std::vector<std::string> result;
-		if (skipDet)
-		{
-			result.push_back(rec->scan(mat));
-		}
-		else
+		Ort::RunOptions runOptions = makeRunOptions(g);
+		if (g.binding && g.bound == &s)
 		{
-			std::vector<cv::Mat> textBlock = det->scan(mat, 1.0f);
-			for (const cv::Mat& i : textBlock)
+			try
 			{
-				std::string text = rec->scan(i);
-				if (text.empty()) continue;
-				result.push_back(text);
+				s.Run(runOptions, g.binding);
+				return g.output.data();
+			}
+			catch (...)
+			{
+				g.binding = Ort::IoBinding(nullptr);
+				g.bound = nullptr;
 			}
 		}
-		return result;
-	}
 
-	std::vector<std::string> scan_list(const RECT& rect, bool skipDet = false)
-	{
-		if (!isInit()) return std::vector<std::string>();
-		int w = rect.right - rect.left;
-		int h = rect.bottom - rect.top;
-		std::vector<std::string> result;
-		if (w > 0 && h > 0)
+		Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+
+		Ort::Value inputTensor = makeInputTensor(g, memoryInfo);
+		if (!inputTensor.IsTensor()) return nullptr;
+
+		std::vector<Ort::Value> outputTensor = s.Run(runOptions, &m_inputName, &inputTensor, 1, &m_outputName, 1);
+		if (outputTensor.size() != 1 || !outputTensor.front().IsTensor()) return nullptr;
+
+		Ort::TensorTypeAndShapeInfo outputInfo = outputTensor.front().GetTensorTypeAndShapeInfo();
+		g.outputShape = outputInfo.GetShape();
+		const float* floatArray = outputTensor.front().GetTensorData<float>();
+		g.output.assign(floatArray, floatArray + outputInfo.GetElementCount());
+
+		if (m_geometryMax)
 		{
-			CImage image; image.Create(w, h, 32);
-			HDC hdc = GetDC(nullptr);
-			if (BitBlt(image.GetDC(), 0, 0, w, h, hdc, rect.left, rect.top, SRCCOPY)) result = scan_list(image);
-			image.ReleaseDC();
-			ReleaseDC(nullptr, hdc);
+			g.binding = Ort::IoBinding(s);
+			g.boundInput = std::move(inputTensor);
+			g.boundOutput = Ort::Value::CreateTensor<float>(memoryInfo, g.output.data(), g.output.size(), g.outputShape.data(), g.outputShape.size());
+			g.binding.BindInput(m_inputName, g.boundInput);
+			g.binding.BindOutput(m_outputName, g.boundOutput);
+			g.bound = &s;
 		}
-		return result;
+		return g.output.data();
 	}
 
-	std::string scan(const CImage& image, bool skipDet = false)
+	static const float* normTable()
 	{
-		std::vector<std::string> result = scan_list(image);
-		std::string text;
-		for (const std::string& i : result)
+		static const std::vector<float> table = []
 		{
-			if (text.empty()) text += i;
-			else text += std::string("\t") + i;
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++) values[i] = (static_cast<float>(i) - s_meanValue) * s_normValue;
+			return values;
+		}();
+		return table.data();
+	}
+
+	static cv::Mat toBgr(const cv::Mat& src)
+	{
+		cv::Mat bgrImage;
+		if (src.channels() == 4) cv::cvtColor(src, bgrImage, cv::COLOR_BGRA2BGR);
+		else if (src.channels() < 3) cv::cvtColor(src, bgrImage, cv::COLOR_GRAY2BGR);
+		else bgrImage = src;
+		return bgrImage;
+	}
+
+	static void fillTensorValues(const cv::Mat& bgrImage, float* tensorValues, int tensorWidth)
+	{
+		const float* table = normTable();
+		size_t imageSize = (size_t)tensorWidth * bgrImage.rows;
+		int width = std::min(bgrImage.cols, tensorWidth);
+
+		for (int y = 0; y < bgrImage.rows; ++y) {
+			const cv::Vec3b* row = bgrImage.ptr<cv::Vec3b>(y);
+			float* red = tensorValues + (size_t)y * tensorWidth;
+			float* green = red + imageSize;
+			float* blue = green + imageSize;
+			for (int x = 0; x < width; ++x) {
+				const cv::Vec3b& pixel = row[x];
+				red[x] = table[pixel[2]];
+				green[x] = table[pixel[1]];
+				blue[x] = table[pixel[0]];
+			}
+			std::fill(red + width, red + tensorWidth, 0.0f);
+			std::fill(green + width, green + tensorWidth, 0.0f);
+			std::fill(blue + width, blue + tensorWidth, 0.0f);
+		}
+	}
+
+	virtual std::vector<float> makeTensorValues(const cv::Mat& src)
+	{
+		return makeTensorValues(src, src.cols);
+	}
+	virtual std::vector<float> makeTensorValues(const cv::Mat& src, int tensorWidth)
+	{
+		if (src.empty()) return std::vector<float>();
+		if (tensorWidth < src.cols) tensorWidth = src.cols;
+
+		std::vector<float> inputTensorValues((size_t)tensorWidth * src.rows * 3);
+		fillTensorValues(toBgr(src), inputTensorValues.data(), tensorWidth);
+		return inputTensorValues;
+	}
+};
+
+class OcrDet : public OcrBase
+{
+	size_t m_maxPixels = 0;
+	size_t m_tileSize = 0;
+	size_t m_tileOverlap = 0;
+	size_t m_tilePixels = 0;
+	int m_coarseScale = 0;
+	int m_maskTile = 0;
+	float m_maskDensity = 0.0f;
+	float m_maskEdge = 24.0f;
+	size_t m_pixelsSkipped = 0;
+	size_t m_rejected = 0;
+	bool m_autoScale = false;
+	double m_textHeight = 0.0;
+	static constexpr int s_textHeightLow = 12;
+	static constexpr double s_textHeightHigh = 48.0;
+	static constexpr double s_textHeightTarget = 24.0;
+	static constexpr size_t s_coarseMinPixels = 1 << 19;
+	static constexpr double s_coarseFullRatio = 0.5;
+public:
+	// rough arena bytes per input pixel of a det run, used to turn a memory budget into a resolution cap
+	static constexpr size_t s_bytesPerPixel = 256;
+
+	int init(void* modelData, size_t modelSize, size_t threads = 2)
+	{
+		if (m_fuse)
+		{
+			std::string fused = OcrGraph::fuseDet(std::string(static_cast<const char*>(modelData), modelSize));
+			if (!fused.empty() && createSession(&fused[0], fused.size(), threads, "OnnxOcrDet") == OnnxOcrResult::r_ok) return OnnxOcrResult::r_ok;
+		}
+		return createSession(modelData, modelSize, threads, "OnnxOcrDet");
+	}
+	int init(const std::string& model, size_t threads = 2)
+	{
+		size_t modelSize;
+		std::unique_ptr<char[]> modelData;
+		if (!readFile(model, modelData, modelSize)) return OnnxOcrResult::r_model_notfound;
+
+		return init(modelData.get(), modelSize, threads);
+	}
+
+	// larger inputs are downscaled to this many pixels before det, 0 = native resolution
+	void setMaxPixels(size_t pixels)
+	{
+		m_maxPixels = pixels;
+	}
+	// det first probes a 1/scale copy and re-runs full resolution only where it found text, 0 = off
+	void setCoarse(int scale)
+	{
+		m_coarseScale = scale;
+	}
+	// tiles with fewer than density pixels stepping by at least edge to a neighbour are cut from det, and a
+	// frame without any is rejected, 0 = off
+	void setMask(int tile, float density, float edge)
+	{
+		m_maskTile = density > 0.0f ? tile : 0;
+		m_maskDensity = density;
+		m_maskEdge = std::max(1.0f, edge);
+	}
+	// det scale of tracked calls follows the text height of earlier tracked frames, small text is re-detected upscaled
+	void setAutoScale(bool enable)
+	{
+		m_autoScale = enable;
+		if (!enable) m_textHeight = 0.0;
+	}
+	// input pixels the mask and the coarse probe kept away from full resolution det
+	size_t skipped() const
+	{
+		return m_pixelsSkipped;
+	}
+	size_t rejected() const
+	{
+		return m_rejected;
+	}
+	// inputs above tilePixels run as overlapping tiles of tileSize, 0 = off
+	void setTiles(size_t tileSize, size_t overlap, size_t tilePixels)
+	{
+		m_tileSize = AlignmentSize(tileSize, 32);
+		m_tileOverlap = overlap;
+		m_tilePixels = tilePixels;
+	}
+
+	std::vector<cv::Mat> scan(const cv::Mat& image, float margin_ratio = 1.0f)
+	{
+		std::vector<cv::Mat> regions;
+		for (const OcrBox& box : detect(image, margin_ratio)) regions.emplace_back(image(box.rect).clone());
+		return regions;
+	}
+
+	// track marks a full frame of the scanned source, only those feed and use the text height estimate
+	std::vector<OcrBox> detect(const cv::Mat& image, float margin_ratio = 1.0f, size_t limit = 0, float minScore = 0.0f, bool track = false)
+	{
+		if (!isInit()) return std::vector<OcrBox>();
+		if (image.empty()) return std::vector<OcrBox>();
+		if (image.channels() < 3) return std::vector<OcrBox>();
+		TrimScope trimScope{ this };
+
+		cv::Mat region = image;
+		cv::Rect bounds(0, 0, image.cols, image.rows);
+		if (m_maskTile)
+		{
+			bounds = textBounds(image);
+			m_pixelsSkipped += image.total() - bounds.area();
+			if (bounds.empty())
+			{
+				m_rejected++;
+				return std::vector<OcrBox>();
+			}
+			region = image(bounds);
+		}
+
+		// large text seen on earlier frames is brought down towards the target height
+		double scale = 1.0;
+		if (m_autoScale && track && m_textHeight > s_textHeightHigh) scale = std::max(0.25, s_textHeightTarget / m_textHeight);
+
+		std::vector<OcrBox> boxes;
+		if (m_coarseScale > 1 && region.total() >= s_coarseMinPixels) boxes = detectCoarse(region, margin_ratio, limit, minScore, scale);
+		else boxes = detectFull(region, margin_ratio, limit, minScore, scale);
+		if (m_autoScale && !limit)
+		{
+			boxes = upscaleSmall(region, boxes, margin_ratio, minScore);
+			if (track) updateTextHeight(boxes, margin_ratio);
+		}
+		for (OcrBox& box : boxes) box.rect += bounds.tl();
+		return boxes;
+	}
+
+	// lines shorter than s_textHeightLow are detected again on an upscaled copy of their neighbourhood
+	std::vector<OcrBox> upscaleSmall(const cv::Mat& image, const std::vector<OcrBox>& boxes, float margin_ratio, float minScore)
+	{
+		double spread = 1.0 + 2.0 * margin_ratio;
+		cv::Rect bounds(0, 0, image.cols, image.rows);
+		std::vector<cv::Rect> regions;
+		for (const OcrBox& box : boxes)
+		{
+			int height = static_cast<int>(box.rect.height / spread);
+			if (height >= s_textHeightLow) continue;
+			cv::Rect padded(box.rect.x - height * 2, box.rect.y - height * 2, box.rect.width + height * 4, box.rect.height + height * 4);
+			regions.push_back(alignRect(padded, 32) & bounds);
+		}
+		if (regions.empty()) return boxes;
+		mergeRects(regions);
+
+		std::vector<OcrBox> result;
+		for (const OcrBox& box : boxes)
+		{
+			cv::Point center(box.rect.x + box.rect.width / 2, box.rect.y + box.rect.height / 2);
+			if (std::none_of(regions.begin(), regions.end(), [&center](const cv::Rect& r) { return r.contains(center); })) result.push_back(box);
+		}
+		for (const cv::Rect& region : regions)
+		{
+			for (OcrBox box : detectFull(image(region), margin_ratio, 0, minScore, s_textHeightTarget / s_textHeightLow))
+			{
+				box.rect += region.tl();
+				result.push_back(box);
+			}
+		}
+		return result;
+	}
+
+	// median text height of the last tracked frame that had any, in input pixels
+	void updateTextHeight(const std::vector<OcrBox>& boxes, float margin_ratio)
+	{
+		if (boxes.empty()) return;
+		std::vector<double> heights;
+		for (const OcrBox& box : boxes) heights.push_back(box.rect.height / (1.0 + 2.0 * margin_ratio));
+		std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+		m_textHeight = heights[heights.size() / 2];
+	}
+
+	// cheap pre-pass: tiles whose share of strong edges stays under m_maskDensity cannot hold text,
+	// returns the 32-aligned bounds of the remaining tiles, empty when none remain
+	cv::Rect textBounds(const cv::Mat& image) const
+	{
+		cv::Rect bounds(0, 0, image.cols, image.rows);
+		if (image.cols < 2 || image.rows < 2) return bounds;
+
+		cv::Mat gray, dx, dy, edges, density;
+		cv::cvtColor(toBgr(image), gray, cv::COLOR_BGR2GRAY);
+		cv::absdiff(gray(cv::Rect(1, 0, gray.cols - 1, gray.rows - 1)), gray(cv::Rect(0, 0, gray.cols - 1, gray.rows - 1)), dx);
+		cv::absdiff(gray(cv::Rect(0, 1, gray.cols - 1, gray.rows - 1)), gray(cv::Rect(0, 0, gray.cols - 1, gray.rows - 1)), dy);
+		cv::max(dx, dy, edges);
+		cv::threshold(edges, edges, m_maskEdge - 1.0f, 255, cv::THRESH_BINARY);
+
+		int tilesX = (edges.cols + m_maskTile - 1) / m_maskTile;
+		int tilesY = (edges.rows + m_maskTile - 1) / m_maskTile;
+		cv::resize(edges, density, cv::Size(tilesX, tilesY), 0, 0, cv::INTER_AREA);
+		cv::Mat mask = density > m_maskDensity * 255.0f;
+		if (!cv::countNonZero(mask)) return cv::Rect();
+
+		cv::Rect tiles = cv::boundingRect(mask);
+		double cellX = static_cast<double>(image.cols) / tilesX;
+		double cellY = static_cast<double>(image.rows) / tilesY;
+		cv::Rect found = scaleRect(cv::Rect(tiles.x - 1, tiles.y - 1, tiles.width + 2, tiles.height + 2), cellX, cellY);
+		return alignRect(found, 32) & bounds;
+	}
+
+	// probes a 1/m_coarseScale copy, then runs full resolution only on the padded regions it found text in
+	std::vector<OcrBox> detectCoarse(const cv::Mat& image, float margin_ratio, size_t limit, float minScore, double scale)
+	{
+		int probeWidth = AlignmentSize(std::max(32, image.cols / m_coarseScale), 32);
+		int probeHeight = AlignmentSize(std::max(32, image.rows / m_coarseScale), 32);
+		cv::Mat probe;
+		cv::resize(toBgr(image), probe, cv::Size(probeWidth, probeHeight), 0, 0, cv::INTER_AREA);
+
+		double scaleX = static_cast<double>(image.cols) / probeWidth;
+		double scaleY = static_cast<double>(image.rows) / probeHeight;
+		cv::Rect bounds(0, 0, image.cols, image.rows);
+		std::vector<cv::Rect> regions;
+		for (const OcrBox& hit : detectFull(probe, 1.0f, 0, 0.0f))
+		{
+			cv::Rect region = scaleRect(hit.rect, scaleX, scaleY);
+			region.x -= m_coarseScale * 4;
+			region.y -= m_coarseScale * 4;
+			region.width += m_coarseScale * 8;
+			region.height += m_coarseScale * 8;
+			region = alignRect(region, 32) & bounds;
+			if (!region.empty()) regions.push_back(region);
+		}
+		mergeRects(regions);
+
+		size_t area = 0;
+		for (const cv::Rect& region : regions) area += region.area();
+		if (area > image.total() * s_coarseFullRatio) return detectFull(image, margin_ratio, limit, minScore, scale);
+		m_pixelsSkipped += image.total() - area;
+
+		std::vector<OcrBox> boxes;
+		for (const cv::Rect& region : regions)
+		{
+			for (OcrBox box : detectFull(image(region), margin_ratio, limit ? limit - boxes.size() : 0, minScore, scale))
+			{
+				box.rect += region.tl();
+				boxes.push_back(box);
+			}
+			if (limit && boxes.size() >= limit) break;
+		}
+		return boxes;
+	}
+
+	std::vector<OcrBox> detectFull(const cv::Mat& image, float margin_ratio, size_t limit, float minScore, double scale = 1.0)
+	{
+		int scaledWidth = image.cols;
+		int scaledHeight = image.rows;
+		if (scale != 1.0)
+		{
+			scaledWidth = std::max(32, static_cast<int>(std::round(image.cols * scale)));
+			scaledHeight = std::max(32, static_cast<int>(std::round(image.rows * scale)));
+		}
+		if (m_maxPixels && (size_t)scaledWidth * scaledHeight > m_maxPixels)
+		{
+			double capScale = std::sqrt(static_cast<double>(m_maxPixels) / ((double)scaledWidth * scaledHeight));
+			scaledWidth = std::max(32, static_cast<int>(scaledWidth * capScale) / 32 * 32);
+			scaledHeight = std::max(32, static_cast<int>(scaledHeight * capScale) / 32 * 32);
+		}
+		int alignedWidth = AlignmentSize(scaledWidth, 32);
+		int alignedHeight = AlignmentSize(scaledHeight, 32);
+		try
+		{
+			if (m_tileSize && (size_t)alignedWidth * alignedHeight > m_tilePixels)
+			{
+				cv::Mat imageScaled = toBgr(image);
+				if (imageScaled.cols != alignedWidth || imageScaled.rows != alignedHeight) cv::resize(imageScaled, imageScaled, cv::Size(alignedWidth, alignedHeight), 0, 0, cv::INTER_LINEAR);
+
+				cv::Mat probMat, binaryMat;
+				if (!tiledProb(imageScaled, probMat)) return std::vector<OcrBox>();
+				return findBoxes(probMat, 255.0, image.size(), binaryMat, margin_ratio, limit, minScore);
+			}
+
+			Geometry& g = geometry({ 1, 3, alignedHeight, alignedWidth });
+
+			cv::Mat imageScaled = toBgr(image);
+			if (imageScaled.cols != alignedWidth || imageScaled.rows != alignedHeight)
+			{
+				cv::resize(imageScaled, g.scaled, cv::Size(alignedWidth, alignedHeight), 0, 0, cv::INTER_LINEAR);
+				imageScaled = g.scaled;
+			}
+			fill(g, 0, imageScaled, alignedWidth);
+
+			cv::Mat outputMat;
+			double unit = 1.0;
+			if (!probability(g, outputMat, unit)) return std::vector<OcrBox>();
+			return findBoxes(outputMat, unit, image.size(), g.scratch, margin_ratio, limit, minScore);
+		}
+		catch (...)
+		{
+			return std::vector<OcrBox>();
+		}
+	}
+
+	// single image probability map, fused models return it as uint8 with unit 255
+	bool probability(Geometry& g, cv::Mat& probMat, double& unit)
+	{
+		const std::vector<int64_t>& outputShape = g.outputShape;
+		if (!hasOutput(OcrGraph::s_probName))
+		{
+			const float* floatArray = run(g);
+			if (!floatArray || outputShape.size() != 4 || outputShape[0] != 1 || outputShape[1] != 1) return false;
+			probMat = cv::Mat(outputShape[2], outputShape[3], CV_32F, (void*)floatArray);
+			unit = 1.0;
+			return true;
+		}
+
+		std::vector<Ort::Value> values = fetch(g, { OcrGraph::s_probName });
+		if (values.size() != 1) return false;
+		Ort::TensorTypeAndShapeInfo outputInfo = values.front().GetTensorTypeAndShapeInfo();
+		g.outputShape = outputInfo.GetShape();
+		if (outputShape.size() != 4 || outputShape[0] != 1 || outputShape[1] != 1) return false;
+		const uint8_t* byteArray = values.front().GetTensorData<uint8_t>();
+		g.bytes.assign(byteArray, byteArray + outputInfo.GetElementCount());
+		probMat = cv::Mat(outputShape[2], outputShape[3], CV_8U, g.bytes.data());
+		unit = 255.0;
+		return true;
+	}
+
+	// probMat holds text probability times unit, boxes are mapped back to an image of imageSize
+	static std::vector<OcrBox> findBoxes(const cv::Mat& probMat, double unit, const cv::Size& imageSize, cv::Mat& binaryMat, float margin_ratio, size_t limit, float minScore)
+	{
+		double thresholdValue = 0.3 * unit;
+		cv::compare(probMat, thresholdValue, binaryMat, cv::CMP_GT);
+
+		std::vector<std::vector<cv::Point>> contours;
+		cv::findContours(binaryMat, contours, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+
+		double scaleX = static_cast<double>(imageSize.width) / probMat.cols;
+		double scaleY = static_cast<double>(imageSize.height) / probMat.rows;
+		cv::Rect bounds(0, 0, imageSize.width, imageSize.height);
+
+		std::vector<OcrBox> boxes;
+		for (auto i = contours.rbegin(); i != contours.rend(); i++)
+		{
+			cv::Rect rect = cv::boundingRect(*i);
+			if (rect.area() < 24) continue;
+
+			float score = static_cast<float>(cv::mean(probMat(rect), binaryMat(rect))[0] / unit);
+			if (score < minScore) continue;
+
+			int margin = std::round(rect.height * margin_ratio);
+			cv::Rect expanded(rect.x - margin, rect.y - margin, rect.width + 2 * margin, rect.height + 2 * margin);
+			cv::Rect mapped = scaleRect(expanded, scaleX, scaleY) & bounds;
+			if (mapped.width <= 0 || mapped.height <= 0) continue;
+
+			boxes.push_back({ mapped, score });
+			if (limit && boxes.size() >= limit) break;
+		}
+		return boxes;
+	}
+
+	// runs det over overlapping same-size tiles into one 8-bit probability map, each tile
+	// contributes its interior so lines crossing a seam come out as a single component
+	bool tiledProb(const cv::Mat& bgrImage, cv::Mat& probMat)
+	{
+		int tileWidth = std::min<int>(m_tileSize, bgrImage.cols);
+		int tileHeight = std::min<int>(m_tileSize, bgrImage.rows);
+		int overlap = std::min<int>(m_tileOverlap, std::min(tileWidth, tileHeight) / 2) / 2 * 2;
+		std::vector<int> xs = tileStarts(bgrImage.cols, tileWidth, tileWidth - overlap);
+		std::vector<int> ys = tileStarts(bgrImage.rows, tileHeight, tileHeight - overlap);
+
+		probMat.create(bgrImage.size(), CV_8U);
+		probMat.setTo(0);
+		Geometry& g = geometry({ 1, 3, tileHeight, tileWidth });
+		cv::Mat tileProb;
+		for (size_t yi = 0; yi < ys.size(); yi++)
+		{
+			for (size_t xi = 0; xi < xs.size(); xi++)
+			{
+				cv::Rect tile(xs[xi], ys[yi], tileWidth, tileHeight);
+				fill(g, 0, bgrImage(tile), tileWidth);
+
+				cv::Mat outputMat;
+				double unit = 1.0;
+				if (!probability(g, outputMat, unit)) return false;
+				if (outputMat.size() != tile.size()) cv::resize(outputMat, tileProb, tile.size(), 0, 0, cv::INTER_LINEAR);
+				else tileProb = outputMat;
+				tileProb.convertTo(tileProb, CV_8U, 255.0 / unit);
+
+				int left = xi ? overlap / 2 : 0;
+				int top = yi ? overlap / 2 : 0;
+				int right = xi + 1 < xs.size() ? tileWidth - overlap / 2 : tileWidth;
+				int bottom = yi + 1 < ys.size() ? tileHeight - overlap / 2 : tileHeight;
+				cv::Rect interior(left, top, right - left, bottom - top);
+				cv::Mat target = probMat(interior + tile.tl());
+				cv::max(target, tileProb(interior), target);
+			}
+		}
+		return true;
+	}
+
+	static cv::Rect alignRect(const cv::Rect& rect, int alignment)
+	{
+		int left = rect.x / alignment * alignment;
+		int top = rect.y / alignment * alignment;
+		int right = AlignmentSize(rect.x + rect.width, alignment);
+		int bottom = AlignmentSize(rect.y + rect.height, alignment);
+		return cv::Rect(left, top, right - left, bottom - top);
+	}
+
+	// rows top to bottom, each row left to right; a row takes the boxes whose center lies within
+	// a quarter of its first box's height, which keeps neighbouring lines of expanded boxes apart
+	static std::vector<size_t> readingOrder(const std::vector<OcrBox>& boxes)
+	{
+		std::vector<size_t> order(boxes.size());
+		std::iota(order.begin(), order.end(), 0);
+		auto centerY = [&boxes](size_t i) { return boxes[i].rect.y * 2 + boxes[i].rect.height; };
+		std::sort(order.begin(), order.end(), [&centerY](size_t a, size_t b) { return centerY(a) < centerY(b); });
+
+		for (size_t begin = 0, end = 0; begin < order.size(); begin = end)
+		{
+			int limit = centerY(order[begin]) + boxes[order[begin]].rect.height / 2;
+			for (end = begin + 1; end < order.size() && centerY(order[end]) < limit; end++);
+			std::sort(order.begin() + begin, order.begin() + end, [&boxes](size_t a, size_t b) { return boxes[a].rect.x < boxes[b].rect.x; });
+		}
+		return order;
+	}
+
+	// merges the fragments of one text line into a single box, a fragment joins a line when its
+	// center sits in the middle half of the taller one and the gap is at most gapRatio of that height
+	static std::vector<OcrBox> assembleLines(const std::vector<OcrBox>& boxes, float gapRatio)
+	{
+		std::vector<OcrBox> lines;
+		for (size_t i : readingOrder(boxes))
+		{
+			const cv::Rect& rect = boxes[i].rect;
+			auto line = std::find_if(lines.rbegin(), lines.rend(), [&rect, gapRatio](const OcrBox& line)
+				{
+					int height = std::max(line.rect.height, rect.height);
+					int dy = std::abs((line.rect.y * 2 + line.rect.height) - (rect.y * 2 + rect.height)) / 2;
+					int gap = std::max(rect.x - line.rect.br().x, line.rect.x - rect.br().x);
+					return dy * 4 < height && gap <= height * gapRatio;
+				});
+			if (line == lines.rend())
+			{
+				lines.push_back(boxes[i]);
+				continue;
+			}
+			double area = line->rect.area() + rect.area();
+			line->score = static_cast<float>((line->score * line->rect.area() + boxes[i].score * rect.area()) / area);
+			line->rect |= rect;
+		}
+
+		std::vector<OcrBox> result;
+		for (size_t i : readingOrder(lines)) result.push_back(lines[i]);
+		return result;
+	}
+
+	// unions overlapping rects until none overlap
+	static void mergeRects(std::vector<cv::Rect>& rects)
+	{
+		for (bool merged = true; merged;)
+		{
+			merged = false;
+			for (size_t i = 0; i < rects.size() && !merged; i++)
+			{
+				for (size_t j = i + 1; j < rects.size(); j++)
+				{
+					if ((rects[i] & rects[j]).empty()) continue;
+					rects[i] |= rects[j];
+					rects.erase(rects.begin() + j);
+					merged = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// tile origins along one axis, the last tile is pinned to the far edge so all tiles share one shape
+	static std::vector<int> tileStarts(int length, int tile, int step)
+	{
+		std::vector<int> starts;
+		for (int s = 0; s + tile < length; s += step) starts.push_back(s);
+		starts.push_back(std::max(0, length - tile));
+		return starts;
+	}
+
+	static cv::Rect scaleRect(const cv::Rect& rect, double scaleX, double scaleY)
+	{
+		int left = static_cast<int>(std::floor(rect.x * scaleX));
+		int top = static_cast<int>(std::floor(rect.y * scaleY));
+		int right = static_cast<int>(std::ceil((rect.x + rect.width) * scaleX));
+		int bottom = static_cast<int>(std::ceil((rect.y + rect.height) * scaleY));
+		return cv::Rect(left, top, right - left, bottom - top);
+	}
+
+	static cv::Mat resizeImage(const cv::Mat& srcImage, size_t alignment = 32)
+	{
+		if (srcImage.empty()) return srcImage;
+
+		int dstWidth = AlignmentSize(srcImage.cols, alignment);
+		int dstHeight = AlignmentSize(srcImage.rows, alignment);
+
+		if (dstWidth == srcImage.cols && dstHeight == srcImage.rows) return srcImage.clone();
+
+		cv::Mat dstImage;
+		cv::resize(srcImage, dstImage, cv::Size(dstWidth, dstHeight), 0, 0, cv::INTER_LINEAR);
+
+		return dstImage;
+	}
+};
+
+// batched crop classifier in the PaddleOCR cls layout: crops scaled to a fixed height, right padded to a
+// fixed width, one score row per crop
+class OcrCls : public OcrBase
+{
+	int m_height = 48;
+	int m_width = 192;
+	size_t m_batchSize = 8;
+public:
+	struct Label
+	{
+		int index;
+		float score;
+	};
+
+	// a model with a fixed input size overrides height and width
+	int init(void* modelData, size_t modelSize, size_t threads = 2, int height = 48, int width = 192)
+	{
+		int result = createSession(modelData, modelSize, threads, "OnnxOcrCls");
+		if (result != OnnxOcrResult::r_ok) return result;
+		m_height = (m_inputShape.size() == 4 && m_inputShape[2] > 0) ? (int)m_inputShape[2] : height;
+		m_width = (m_inputShape.size() == 4 && m_inputShape[3] > 0) ? (int)m_inputShape[3] : width;
+		return OnnxOcrResult::r_ok;
+	}
+	int init(const std::string& model, size_t threads = 2, int height = 48, int width = 192)
+	{
+		size_t modelSize;
+		std::unique_ptr<char[]> modelData;
+		if (!readFile(model, modelData, modelSize)) return OnnxOcrResult::r_model_notfound;
+
+		return init(modelData.get(), modelSize, threads, height, width);
+	}
+
+	void setBatchSize(size_t size)
+	{
+		m_batchSize = size ? size : 1;
+	}
+
+	// best class per image, index -1 for images that could not be classified
+	std::vector<Label> classify(const std::vector<cv::Mat>& images)
+	{
+		std::vector<Label> result(images.size(), { -1, 0.0f });
+		if (!isInit()) return result;
+		TrimScope trimScope{ this };
+
+		std::vector<size_t> valid;
+		for (size_t i = 0; i < images.size(); i++) if (!images[i].empty()) valid.push_back(i);
+
+		size_t batchSize = (m_inputShape.size() == 4 && m_inputShape[0] < 0) ? m_batchSize : 1;
+		for (size_t first = 0; first < valid.size(); first += batchSize)
+		{
+			size_t count = std::min(batchSize, valid.size() - first);
+			try
+			{
+				Geometry& g = geometry({ (int64_t)count, 3, m_height, m_width });
+				for (size_t i = 0; i < count; i++) fill(g, i, prepare(images[valid[first + i]]), m_width);
+
+				const float* floatArray = run(g);
+				if (!floatArray || g.outputShape.size() != 2 || (size_t)g.outputShape[0] != count || g.outputShape[1] <= 0) continue;
+				int classes = (int)g.outputShape[1];
+				for (size_t i = 0; i < count; i++)
+				{
+					const float* row = floatArray + i * classes;
+					const float* best = std::max_element(row, row + classes);
+					result[valid[first + i]] = { (int)(best - row), *best };
+				}
+			}
+			catch (...)
+			{
+			}
+		}
+		return result;
+	}
+
+	cv::Mat prepare(const cv::Mat& image) const
+	{
+		cv::Mat bgrImage = toBgr(image);
+		int width = std::min(m_width, std::max(1, (int)std::ceil(m_height * (double)bgrImage.cols / bgrImage.rows)));
+		cv::Mat scaled;
+		cv::resize(bgrImage, scaled, cv::Size(width, m_height), 0, 0, cv::INTER_LINEAR);
+		return scaled;
+	}
+};
+
+class OcrCache
+{
+public:
+	struct Key
+	{
+		uint64_t hash = 0;
+		uint64_t seed = 0;
+		int width = 0;
+		std::vector<uint64_t> signature;
+	};
+private:
+	struct Entry
+	{
+		Key key;
+		OcrText value;
+		size_t bytes;
+	};
+	static constexpr int s_blockSize = 6;
+	std::list<Entry> m_entries;
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> m_exact;
+	size_t m_bytes = 0;
+	size_t m_capacity = 0;
+	int m_tolerance = -1;
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+public:
+	size_t hits() const
+	{
+		return m_hits;
+	}
+
+	size_t misses() const
+	{
+		return m_misses;
+	}
+
+	void setCapacity(size_t bytes, int tolerance)
+	{
+		if (tolerance != m_tolerance) clear();
+		m_capacity = bytes;
+		m_tolerance = tolerance;
+		trim(m_capacity);
+	}
+
+	bool enabled() const
+	{
+		return m_capacity > 0;
+	}
+
+	void clear()
+	{
+		m_entries.clear();
+		m_exact.clear();
+		m_bytes = 0;
+	}
+
+	void trim(size_t bytes)
+	{
+		while (m_bytes > bytes && !m_entries.empty())
+		{
+			m_exact.erase(m_entries.back().key.hash);
+			m_bytes -= m_entries.back().bytes;
+			m_entries.pop_back();
+		}
+	}
+
+	// seed separates results read under different charsets, 0 = unrestricted
+	Key makeKey(const cv::Mat& line, uint64_t seed = 0) const
+	{
+		Key key;
+		key.hash = OcrBase::hashImage(line, seed);
+		key.seed = seed;
+		key.width = line.cols;
+		if (m_tolerance < 0) return key;
+
+		cv::Mat gray, blocks;
+		cv::cvtColor(line, gray, cv::COLOR_BGR2GRAY);
+		cv::resize(gray, blocks, cv::Size((line.cols + s_blockSize - 1) / s_blockSize, (line.rows + s_blockSize - 1) / s_blockSize), 0, 0, cv::INTER_AREA);
+		double mean = cv::mean(blocks)[0];
+
+		key.signature.assign((blocks.total() + 63) / 64, 0);
+		size_t bit = 0;
+		for (int y = 0; y < blocks.rows; y++)
+		{
+			const uchar* row = blocks.ptr<uchar>(y);
+			for (int x = 0; x < blocks.cols; x++, bit++) if (row[x] > mean) key.signature[bit / 64] |= 1ull << (bit % 64);
+		}
+		return key;
+	}
+
+	bool find(const Key& key, OcrText& value)
+	{
+		auto found = m_entries.end();
+		if (m_tolerance < 0)
+		{
+			auto i = m_exact.find(key.hash);
+			if (i != m_exact.end()) found = i->second;
+		}
+		else
+		{
+			for (auto i = m_entries.begin(); i != m_entries.end(); i++)
+			{
+				if (i->key.seed != key.seed || i->key.width != key.width || i->key.signature.size() != key.signature.size()) continue;
+				int distance = 0;
+				for (size_t w = 0; w < key.signature.size() && distance <= m_tolerance; w++) distance += bitCount(i->key.signature[w] ^ key.signature[w]);
+				if (distance > m_tolerance) continue;
+				found = i;
+				break;
+			}
+		}
+
+		if (found == m_entries.end())
+		{
+			m_misses++;
+			return false;
+		}
+		m_entries.splice(m_entries.begin(), m_entries, found);
+		value = found->value;
+		m_hits++;
+		return true;
+	}
+
+	void insert(const Key& key, const OcrText& value)
+	{
+		if (!enabled()) return;
+		auto i = m_exact.find(key.hash);
+		if (i != m_exact.end())
+		{
+			m_bytes -= i->second->bytes;
+			m_entries.erase(i->second);
+			m_exact.erase(i);
+		}
+
+		size_t bytes = sizeof(Entry) + value.text.size() + key.signature.size() * sizeof(uint64_t) + 32;
+		m_entries.push_front({ key, value, bytes });
+		m_exact[key.hash] = m_entries.begin();
+		m_bytes += bytes;
+		trim(m_capacity);
+	}
+
+	static uint64_t hashColumns(const std::vector<int>& columns)
+	{
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (int column : columns) hash = (hash ^ (uint64_t)column) * 0x100000001B3ull;
+		return hash;
+	}
+
+	static int bitCount(uint64_t value)
+	{
+		value = value - ((value >> 1) & 0x5555555555555555ull);
+		value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+		value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (int)((value * 0x0101010101010101ull) >> 56);
+	}
+};
+
+class OcrRec : public OcrBase
+{
+public:
+	// sorted output columns decoding may pick from, blank first, nullptr = every class
+	using Charset = std::shared_ptr<const std::vector<int>>;
+private:
+	std::vector<std::string> m_keys;
+	std::unordered_map<std::string, int> m_keyColumns;
+	std::map<std::string, Charset> m_charsets;
+	size_t m_scaleSize = 48;
+	size_t m_widthBucket = 0;
+	size_t m_bucketMaxWidth = 0;
+	size_t m_chunkWidth = 0;
+	size_t m_chunkOverlap = 0;
+	size_t m_batchSize = 1;
+	size_t m_packWidth = 0;
+	size_t m_packGap = 0;
+	int m_trimPad = -1;
+	OcrCache m_cache;
+public:
+	// rough arena bytes per input column of a rec run at height 48
+	static constexpr size_t s_bytesPerColumn = 16 * 1024;
+	struct Step
+	{
+		int index;
+		float score;
+	};
+	struct Segment
+	{
+		cv::Mat image;
+		size_t owner;
+		int offset;
+		int begin;
+		int end;
+		bool last;
+	};
+	// columns of a rec input that decode into one segment
+	struct Piece
+	{
+		size_t segment;
+		int begin;
+		int end;
+		bool last;
+	};
+	struct Input
+	{
+		cv::Mat image;
+		std::vector<Piece> pieces;
+	};
+
+	int init(void* modelData, size_t modelSize, const std::vector<std::string>& keys, size_t threads = 2, size_t scaleSize = 48)
+	{
+		OcrBase::release();
+		m_keys = keys;
+		m_scaleSize = scaleSize;
+		m_charsets.clear();
+		m_keyColumns.clear();
+		for (size_t i = 0; i < m_keys.size(); i++) m_keyColumns.emplace(m_keys[i], (int)i + 1);
+		if (m_keys.empty()) return OnnxOcrResult::r_keys_invalid;
+
+		if (m_fuse)
+		{
+			std::string fused = OcrGraph::fuseRec(std::string(static_cast<const char*>(modelData), modelSize));
+			if (!fused.empty() && createSession(&fused[0], fused.size(), threads, "OnnxOcrRec") == OnnxOcrResult::r_ok) return OnnxOcrResult::r_ok;
+		}
+		return createSession(modelData, modelSize, threads, "OnnxOcrRec");
+	}
+	int init(void* modelData, size_t modelSize, void* keysData, size_t keysSize, size_t threads = 2, size_t scaleSize = 48)
+	{
+		std::istringstream keysDataStream(std::string((const char*)keysData, keysSize));
+		std::vector<std::string> keys;
+		std::string line;
+		while (std::getline(keysDataStream, line))
+		{
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			keys.push_back(line);
+		}
+
+		return init(modelData, modelSize, keys, threads, scaleSize);
+	}
+	int init(const std::string& model, const std::string& keys, size_t threads = 2, size_t scaleSize = 48)
+	{
+		size_t modelSize;
+		std::unique_ptr<char[]> modelData;
+		if (!readFile(model, modelData, modelSize)) return OnnxOcrResult::r_model_notfound;
+
+		std::ifstream keysFile(keys);
+		if (!keysFile) return OnnxOcrResult::r_keys_notfound;
+		std::vector<std::string> keysData;
+		std::string line;
+		while (std::getline(keysFile, line))
+		{
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			keysData.push_back(line);
+		}
+
+		return init(modelData.get(), modelSize, keysData, threads, scaleSize);
+	}
+
+	void setWidthBucket(size_t bucket, size_t maxWidth)
+	{
+		m_widthBucket = bucket;
+		m_bucketMaxWidth = maxWidth;
+	}
+
+	int bucketWidth(int width) const
+	{
+		if (width <= 0 || m_widthBucket < 2) return width;
+		if (m_bucketMaxWidth && (size_t)width > m_bucketMaxWidth) return width;
+		size_t bucketed = AlignmentSize((size_t)width, m_widthBucket);
+		if (m_bucketMaxWidth && bucketed > m_bucketMaxWidth) bucketed = m_bucketMaxWidth;
+		return (int)bucketed;
+	}
+
+	void setChunk(size_t width, size_t overlap)
+	{
+		m_chunkWidth = width;
+		m_chunkOverlap = overlap;
+	}
+
+	void setBatchSize(size_t size)
+	{
+		m_batchSize = size ? size : 1;
+	}
+
+	// short lines are packed side by side into inputs up to width, gap columns apart, 0 = off
+	void setPacking(size_t width, size_t gap)
+	{
+		m_packWidth = width;
+		m_packGap = gap;
+	}
+
+	void setTrimPad(int pad)
+	{
+		m_trimPad = pad;
+	}
+
+	OcrCache& cache()
+	{
+		return m_cache;
+	}
+
+	const std::vector<std::string>& keys() const
+	{
+		return m_keys;
+	}
+	size_t scaleSize() const
+	{
+		return m_scaleSize;
+	}
+
+	// compiles a UTF-8 list of allowed characters once, characters outside the keys are ignored
+	Charset charset(const char* chars)
+	{
+		if (!chars || !*chars) return nullptr;
+		auto found = m_charsets.find(chars);
+		if (found != m_charsets.end()) return found->second;
+
+		std::vector<int> columns = { 0 };
+		for (const char* c = chars; *c;)
+		{
+			unsigned char lead = static_cast<unsigned char>(*c);
+			size_t length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+			size_t available = 1;
+			while (available < length && c[available]) available++;
+			auto column = m_keyColumns.find(std::string(c, available));
+			if (column != m_keyColumns.end()) columns.push_back(column->second);
+			c += available;
+		}
+		std::sort(columns.begin(), columns.end());
+		columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+
+		if (m_charsets.size() >= 64) m_charsets.clear();
+		Charset compiled = std::make_shared<const std::vector<int>>(std::move(columns));
+		m_charsets.emplace(chars, compiled);
+		return compiled;
+	}
+
+	std::string scoreToString(const std::vector<float>& outputData, int h, int w)
+	{
+		return scoreToString(outputData.data(), h, w);
+	}
+	std::string scoreToString(const float* outputData, int h, int w)
+	{
+		std::vector<Step> steps;
+		argmax(outputData, 0, h, w, steps);
+		return stepsToString(steps);
+	}
+
+	std::string stepsToString(const std::vector<Step>& steps) const
+	{
+		return stepsToText(steps).text;
+	}
+
+	OcrText stepsToText(const std::vector<Step>& steps) const
+	{
+		OcrText result;
+		int indexPrev = 0;
+		double scoreSum = 0.0;
+		size_t count = 0;
+		for (const Step& step : steps)
+		{
+			if (step.index > 0 && step.index <= (int)m_keys.size() && step.index != indexPrev)
+			{
+				result.text += m_keys[step.index - 1];
+				result.minScore = count ? std::min(result.minScore, step.score) : step.score;
+				scoreSum += step.score;
+				count++;
+			}
+			indexPrev = step.index;
+		}
+		if (count) result.score = static_cast<float>(scoreSum / count);
+		return result;
+	}
+
+	std::string scan(const cv::Mat& image, const Charset& charset = nullptr)
+	{
+		return scan(std::vector<cv::Mat>{ image }, charset).front();
+	}
+
+	std::vector<std::string> scan(const std::vector<cv::Mat>& images, const Charset& charset = nullptr)
+	{
+		return scan(images, std::vector<Charset>(charset ? images.size() : 0, charset));
+	}
+
+	std::vector<std::string> scan(const std::vector<cv::Mat>& images, const std::vector<Charset>& charsets)
+	{
+		std::vector<std::string> result;
+		for (OcrText& text : read(images, charsets)) result.push_back(std::move(text.text));
+		return result;
+	}
+
+	// charsets is empty or holds one entry per image, restricted lines are cached under their charset
+	std::vector<OcrText> read(const std::vector<cv::Mat>& images, const std::vector<Charset>& charsets = std::vector<Charset>())
+	{
+		std::vector<OcrText> result(images.size());
+		if (!isInit()) return result;
+		TrimScope trimScope{ this };
+
+		std::vector<Segment> segments;
+		std::vector<OcrCache::Key> keys(images.size());
+		for (size_t i = 0; i < images.size(); i++)
+		{
+			if (images[i].empty() || images[i].channels() < 3) continue;
+			cv::Mat image = toBgr(images[i]);
+			if (m_trimPad >= 0)
+			{
+				cv::Rect extent = inkExtent(image, m_trimPad);
+				if (!extent.empty()) image = image(extent);
+			}
+			cv::Mat line = resizeWithHeight(image, m_scaleSize);
+			if (m_cache.enabled())
+			{
+				keys[i] = m_cache.makeKey(line, charsets.empty() || !charsets[i] ? 0 : OcrCache::hashColumns(*charsets[i]));
+				if (m_cache.find(keys[i], result[i])) continue;
+			}
+			split(line, i, segments);
+		}
+
+		std::vector<bool> ok;
+		std::vector<std::vector<Step>> steps = recognize(segments, charsets, ok);
+		std::vector<std::vector<Step>> lines(images.size());
+		std::vector<bool> recognized(images.size(), false);
+		std::vector<bool> failed(images.size(), false);
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			std::vector<Step>& line = lines[segments[i].owner];
+			line.insert(line.end(), steps[i].begin(), steps[i].end());
+			recognized[segments[i].owner] = true;
+			if (!ok[i]) failed[segments[i].owner] = true;
+		}
+		for (size_t i = 0; i < lines.size(); i++)
+		{
+			if (!recognized[i]) continue;
+			result[i] = stepsToText(lines[i]);
+			if (m_cache.enabled() && !failed[i]) m_cache.insert(keys[i], result[i]);
+		}
+		return result;
+	}
+
+	void split(const cv::Mat& line, size_t owner, std::vector<Segment>& segments) const
+	{
+		int width = line.cols;
+		int window = (int)m_chunkWidth;
+		if (window <= 0 || width <= window)
+		{
+			segments.push_back({ line, owner, 0, 0, width, true });
+			return;
+		}
+
+		int overlap = std::min((int)m_chunkOverlap, window / 4);
+		std::vector<int> ink = columnInk(line);
+		int cut = 0;
+		while (true)
+		{
+			int start = std::max(0, cut - overlap);
+			if (width - start <= window)
+			{
+				segments.push_back({ line.colRange(start, width), owner, start, cut, width, true });
+				return;
+			}
+
+			int last = start + window - overlap;
+			int first = std::max(cut + 1, last - (window - 2 * overlap) / 2);
+			int next = last;
+			for (int x = last; x >= first; x--) if (ink[x] < ink[next]) next = x;
+
+			segments.push_back({ line.colRange(start, next + overlap), owner, start, cut, next, false });
+			cut = next;
+		}
+	}
+
+	// whole lines narrower than half the pack width share inputs, each padded with its own
+	// replicated border so the gap reads as background and decodes to blanks
+	std::vector<Input> pack(const std::vector<Segment>& segments) const
+	{
+		std::vector<Input> inputs;
+		std::vector<size_t> shorts;
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			const Segment& segment = segments[i];
+			if (m_packWidth && segment.last && segment.offset == 0 && (size_t)segment.image.cols + m_packGap <= m_packWidth / 2) shorts.push_back(i);
+			else inputs.push_back({ segment.image, { { i, segment.begin - segment.offset, segment.end - segment.offset, segment.last } } });
+		}
+
+		int left = (int)m_packGap / 2;
+		int right = (int)m_packGap - left;
+		for (size_t first = 0; first < shorts.size();)
+		{
+			std::vector<cv::Mat> parts;
+			Input input;
+			int width = 0;
+			for (; first < shorts.size(); first++)
+			{
+				const Segment& segment = segments[shorts[first]];
+				int padded = segment.image.cols + (int)m_packGap;
+				if (!parts.empty() && (size_t)(width + padded) > m_packWidth) break;
+
+				parts.emplace_back();
+				cv::copyMakeBorder(segment.image, parts.back(), 0, 0, left, right, cv::BORDER_REPLICATE);
+				input.pieces.push_back({ shorts[first], width + left + segment.begin, width + left + segment.end, false });
+				width += padded;
+			}
+			if (parts.size() == 1)
+			{
+				const Segment& segment = segments[input.pieces.front().segment];
+				inputs.push_back({ segment.image, { { input.pieces.front().segment, segment.begin, segment.end, true } } });
+				continue;
+			}
+			cv::hconcat(parts, input.image);
+			inputs.push_back(std::move(input));
+		}
+		return inputs;
+	}
+
+	std::vector<std::vector<Step>> recognize(const std::vector<Segment>& segments, const std::vector<Charset>& charsets, std::vector<bool>& ok)
+	{
+		std::vector<std::vector<Step>> steps(segments.size());
+		ok.assign(segments.size(), false);
+		std::vector<Input> inputs = pack(segments);
+		std::vector<size_t> order(inputs.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return inputs[a].image.cols < inputs[b].image.cols; });
+
+		size_t batchSize = (m_inputShape.size() == 4 && m_inputShape[0] < 0) ? m_batchSize : 1;
+		bool fused = hasOutput(OcrGraph::s_indexName) && hasOutput(OcrGraph::s_scoreName);
+		for (size_t first = 0; first < order.size();)
+		{
+			int tensorWidth = bucketWidth(inputs[order[first]].image.cols);
+			int widthLimit = tensorWidth + tensorWidth / 4;
+			size_t count = 1;
+			while (count < batchSize && first + count < order.size())
+			{
+				int width = bucketWidth(inputs[order[first + count]].image.cols);
+				if (width > widthLimit) break;
+				tensorWidth = width;
+				count++;
+			}
+
+			try
+			{
+				Geometry& g = geometry({ (int64_t)count, 3, (int64_t)m_scaleSize, tensorWidth });
+				for (size_t i = 0; i < count; i++) fill(g, i, inputs[order[first + i]].image, tensorWidth);
+
+				if (fused && !restricted(inputs, order, first, count, segments, charsets)) decodeFused(g, inputs, order, first, count, tensorWidth, steps, ok);
+				else
+				{
+					const float* floatArray = run(g);
+					if (floatArray && g.outputShape.size() == 3 && (size_t)g.outputShape[0] == count && g.outputShape[1] > 0)
+					{
+						int timesteps = (int)g.outputShape[1];
+						int classes = (int)g.outputShape[2];
+						double ratio = static_cast<double>(tensorWidth) / timesteps;
+						for (size_t i = 0; i < count; i++)
+						{
+							for (const Piece& piece : inputs[order[first + i]].pieces)
+							{
+								int t0 = std::min(timesteps, (int)std::round(piece.begin / ratio));
+								int t1 = piece.last ? timesteps : std::min(timesteps, (int)std::round(piece.end / ratio));
+								const Charset& charset = charsets.empty() ? nullptr : charsets[segments[piece.segment].owner];
+								if (charset) argmax(floatArray + i * timesteps * classes, t0, t1, classes, *charset, steps[piece.segment]);
+								else argmax(floatArray + i * timesteps * classes, t0, t1, classes, steps[piece.segment]);
+								ok[piece.segment] = true;
+							}
+						}
+					}
+				}
+			}
+			catch (...)
+			{
+			}
+			first += count;
+		}
+		return steps;
+	}
+
+	static bool restricted(const std::vector<Input>& inputs, const std::vector<size_t>& order, size_t first, size_t count, const std::vector<Segment>& segments, const std::vector<Charset>& charsets)
+	{
+		if (charsets.empty()) return false;
+		for (size_t i = 0; i < count; i++)
+		{
+			for (const Piece& piece : inputs[order[first + i]].pieces) if (charsets[segments[piece.segment].owner]) return true;
+		}
+		return false;
+	}
+
+	// fused models already did the argmax in the graph, only the per timestep index and score come back
+	void decodeFused(Geometry& g, const std::vector<Input>& inputs, const std::vector<size_t>& order, size_t first, size_t count, int tensorWidth, std::vector<std::vector<Step>>& steps, std::vector<bool>& ok)
+	{
+		std::vector<Ort::Value> values = fetch(g, { OcrGraph::s_indexName, OcrGraph::s_scoreName });
+		if (values.size() != 2) return;
+		std::vector<int64_t> shape = values[0].GetTensorTypeAndShapeInfo().GetShape();
+		if (shape.size() != 2 || (size_t)shape[0] != count || shape[1] <= 0 || values[1].GetTensorTypeAndShapeInfo().GetShape() != shape) return;
+
+		const int64_t* indices = values[0].GetTensorData<int64_t>();
+		const float* scores = values[1].GetTensorData<float>();
+		int timesteps = (int)shape[1];
+		double ratio = static_cast<double>(tensorWidth) / timesteps;
+		for (size_t i = 0; i < count; i++)
+		{
+			for (const Piece& piece : inputs[order[first + i]].pieces)
+			{
+				int t0 = std::min(timesteps, (int)std::round(piece.begin / ratio));
+				int t1 = piece.last ? timesteps : std::min(timesteps, (int)std::round(piece.end / ratio));
+				for (int t = t0; t < t1; t++) steps[piece.segment].push_back({ (int)indices[i * timesteps + t], scores[i * timesteps + t] });
+				ok[piece.segment] = true;
+			}
+		}
+	}
+
+	static void argmax(const float* scores, int first, int last, int classes, std::vector<Step>& steps)
+	{
+		for (int t = first; t < last; t++)
+		{
+			const float* row = scores + (size_t)t * classes;
+			const float* best = std::max_element(row, row + classes);
+			steps.push_back({ (int)(best - row), *best });
+		}
+	}
+
+	// only looks at the given columns, so decode cost follows the charset size instead of the class count
+	static void argmax(const float* scores, int first, int last, int classes, const std::vector<int>& columns, std::vector<Step>& steps)
+	{
+		for (int t = first; t < last; t++)
+		{
+			const float* row = scores + (size_t)t * classes;
+			Step best = { 0, row[0] };
+			for (int column : columns)
+			{
+				if (column < classes && row[column] > best.score) best = { column, row[column] };
+			}
+			steps.push_back(best);
+		}
+	}
+
+	static int borderMedian(const cv::Mat& gray)
+	{
+		int histogram[256] = {};
+		int count = 0;
+		for (int x = 0; x < gray.cols; x++)
+		{
+			histogram[gray.at<uchar>(0, x)]++;
+			histogram[gray.at<uchar>(gray.rows - 1, x)]++;
+			count += 2;
+		}
+		for (int y = 1; y < gray.rows - 1; y++)
+		{
+			histogram[gray.at<uchar>(y, 0)]++;
+			histogram[gray.at<uchar>(y, gray.cols - 1)]++;
+			count += 2;
+		}
+		for (int i = 0, sum = 0; i < 256; i++)
+		{
+			sum += histogram[i];
+			if (sum * 2 >= count) return i;
+		}
+		return 255;
+	}
+
+	static cv::Rect inkExtent(const cv::Mat& bgrImage, int pad, double threshold = 40.0)
+	{
+		cv::Mat gray, ink, cols, rows;
+		cv::cvtColor(bgrImage, gray, cv::COLOR_BGR2GRAY);
+		cv::absdiff(gray, cv::Scalar(borderMedian(gray)), ink);
+		cv::threshold(ink, ink, threshold, 255, cv::THRESH_BINARY);
+		cv::reduce(ink, cols, 0, cv::REDUCE_MAX);
+		cv::reduce(ink, rows, 1, cv::REDUCE_MAX);
+
+		const uchar* colInk = cols.ptr<uchar>(0);
+		int left = 0, right = cols.cols - 1;
+		while (left <= right && !colInk[left]) left++;
+		while (right >= left && !colInk[right]) right--;
+		if (left > right) return cv::Rect();
+
+		int top = 0, bottom = rows.rows - 1;
+		while (top <= bottom && !rows.at<uchar>(top, 0)) top++;
+		while (bottom >= top && !rows.at<uchar>(bottom, 0)) bottom--;
+
+		cv::Rect extent(left - pad, top - pad, right - left + 1 + 2 * pad, bottom - top + 1 + 2 * pad);
+		return extent & cv::Rect(0, 0, bgrImage.cols, bgrImage.rows);
+	}
+
+	static std::vector<int> columnInk(const cv::Mat& bgrImage)
+	{
+		cv::Mat gray, colMax, colMin, contrast;
+		cv::cvtColor(bgrImage, gray, cv::COLOR_BGR2GRAY);
+		cv::reduce(gray, colMax, 0, cv::REDUCE_MAX);
+		cv::reduce(gray, colMin, 0, cv::REDUCE_MIN);
+		cv::subtract(colMax, colMin, contrast);
+		return std::vector<int>(contrast.begin<uchar>(), contrast.end<uchar>());
+	}
+
+	static cv::Mat resizeWithHeight(const cv::Mat& srcImage, size_t height) {
+		double scaleFactor = static_cast<double>(height) / srcImage.rows;
+		int newWidth = std::max(1, static_cast<int>(srcImage.cols * scaleFactor));
+		cv::Mat destImage;
+		cv::resize(srcImage, destImage, cv::Size(newWidth, height), 0, 0, cv::INTER_LINEAR);
+		return destImage;
+	}
+};
+
+class QiOcrTool
+{
+	class OcrDet* det;
+	class OcrRec* rec;
+	class OcrRec* fallback = nullptr;
+	std::vector<class OcrRec*> scripts;
+	class OcrCls* scriptCls = nullptr;
+	class OcrCls* directionCls = nullptr;
+	struct Frame
+	{
+		cv::Mat image;
+		std::vector<OcrBox> boxes;
+		std::vector<std::string> texts;
+		std::string charset;
+		int script = -1;
+	};
+	struct Watch
+	{
+		RECT rect;
+		std::chrono::milliseconds interval;
+		QiOcrWatchCallback callback;
+		void* user;
+		std::chrono::steady_clock::time_point due;
+		uint64_t hash;
+		bool scanned;
+		std::string text;
+	};
+	QiOcrConfig m_config;
+	QiOcrStats m_stats;
+	Frame m_frame;
+	std::mutex m_mutex;
+	std::map<int, Watch> m_watches;
+	std::thread m_watchThread;
+	std::thread m_idleThread;
+	std::mutex m_watchMutex;
+	std::condition_variable m_watchWake;
+	int m_watchId = 0;
+	bool m_watchStop = false;
+	std::function<int()> m_recLoad, m_detLoad;
+	std::shared_future<int> m_recReady, m_detReady;
+	std::atomic<bool> m_recReported{ false }, m_detReported{ false };
+	mutable std::mutex m_loadMutex;
+	std::shared_timed_mutex m_settingsMutex;
+	std::atomic<int64_t> m_lastUse{ 0 };
+	std::atomic<int> m_idleTimeout{ 0 };
+	static constexpr float s_boxMargin = 0.5f;
+public:
+	QiOcrTool(const QiOcrConfig& config = QiOcrConfig()) : rec(new OcrRec), det(new OcrDet)
+	{
+		size_t threads = defaultThreads();
+		m_recLoad = [this, threads]
+			{
+				return rec->init("OCR\\ppocr.onnx", "OCR\\ppocr.keys", threads, 48);
+			};
+		m_detLoad = [this, threads]
+			{
+				return det->init("OCR\\ppdet.onnx", threads);
+			};
+		start(config);
+	}
+	QiOcrTool(void* recData, size_t recSize, void* keyData, size_t keySize, void* detData, size_t detSize, const QiOcrConfig& config = QiOcrConfig()) : rec(new OcrRec), det(new OcrDet)
+	{
+		size_t threads = defaultThreads();
+		// the caller's buffers only live for the init call, a lazy load needs its own copy
+		auto recModel = std::make_shared<std::string>(static_cast<const char*>(recData), recSize);
+		auto keys = std::make_shared<std::string>(static_cast<const char*>(keyData), keySize);
+		auto detModel = std::make_shared<std::string>(static_cast<const char*>(detData), detSize);
+		m_recLoad = [this, threads, recModel, keys]
+			{
+				return rec->init(&(*recModel)[0], recModel->size(), &(*keys)[0], keys->size(), threads, 48);
+			};
+		m_detLoad = [this, threads, detModel]
+			{
+				return det->init(&(*detModel)[0], detModel->size(), threads);
+			};
+		start(config);
+	}
+
+	~QiOcrTool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_watchMutex);
+			m_watchStop = true;
+		}
+		m_watchWake.notify_all();
+		if (m_watchThread.joinable()) m_watchThread.join();
+		if (m_idleThread.joinable()) m_idleThread.join();
+		waitLoads();
+		delete directionCls;
+		delete scriptCls;
+		for (OcrRec* recognizer : scripts) delete recognizer;
+		delete fallback;
+		delete rec;
+		delete det;
+	}
+
+	static size_t defaultThreads()
+	{
+		SYSTEM_INFO info; GetSystemInfo(&info);
+		size_t threads = info.dwNumberOfProcessors >> 1;
+		if (threads < 2) threads = 2;
+		return threads;
+	}
+
+	void start(const QiOcrConfig& config)
+	{
+		setConfig(config);
+		if (config.lazyInit) return;
+		load(m_recLoad, m_recReady);
+		load(m_detLoad, m_detReady);
+	}
+
+	// starts a model load on its own thread unless it is already loading or loaded
+	void load(std::function<int()>& loader, std::shared_future<int>& ready)
+	{
+		std::lock_guard<std::mutex> lock(m_loadMutex);
+		if (ready.valid()) return;
+		// a load holds the settings shared so setConfig does not change a model while it loads
+		std::function<int()> run = loader;
+		ready = std::async(std::launch::async, [this, run]
+			{
+				std::shared_lock<std::shared_timed_mutex> settings(m_settingsMutex);
+				return run();
+			}).share();
+		loader = nullptr;
+	}
+
+	// report shows a failed load to the calling thread, the watch thread leaves it to the caller's scans
+	bool ensureRec(bool report = true)
+	{
+		touch();
+		load(m_recLoad, m_recReady);
+		return report ? reported(m_recReady, m_recReported, L"OCR识别初始化错误") : loaded(m_recReady, true);
+	}
+
+	bool ensureDet(bool report = true)
+	{
+		touch();
+		load(m_detLoad, m_detReady);
+		return report ? reported(m_detReady, m_detReported, L"OCR检测初始化错误") : loaded(m_detReady, true);
+	}
+
+	// waits for a load on the calling thread, outside the settings and load locks, and shows its error once
+	bool reported(const std::shared_future<int>& ready, std::atomic<bool>& shown, const wchar_t* title)
+	{
+		std::shared_future<int> future;
+		{
+			std::lock_guard<std::mutex> lock(m_loadMutex);
+			future = ready;
+		}
+		if (!future.valid()) return false;
+		int result = future.get();
+		if (result != OnnxOcrResult::r_ok && !shown.exchange(true)) showResult(result, title);
+		return result == OnnxOcrResult::r_ok;
+	}
+
+	bool loaded(const std::shared_future<int>& ready, bool wait) const
+	{
+		std::shared_future<int> future;
+		{
+			std::lock_guard<std::mutex> lock(m_loadMutex);
+			future = ready;
+		}
+		if (!future.valid()) return false;
+		if (!wait && future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+		return future.get() == OnnxOcrResult::r_ok;
+	}
+
+	void touch()
+	{
+		m_lastUse = std::chrono::steady_clock::now().time_since_epoch().count();
+	}
+
+	// blocks until every started load has finished and shows their errors, false if one of them failed
+	bool waitInit()
+	{
+		bool recOk = !started(m_recReady) || reported(m_recReady, m_recReported, L"OCR识别初始化错误");
+		bool detOk = !started(m_detReady) || reported(m_detReady, m_detReported, L"OCR检测初始化错误");
+		return recOk && detOk;
+	}
+
+	bool started(const std::shared_future<int>& ready) const
+	{
+		std::lock_guard<std::mutex> lock(m_loadMutex);
+		return ready.valid();
+	}
+
+	// blocks until every started load has finished, false if one of them failed
+	bool waitLoads() const
+	{
+		bool ok = true;
+		std::shared_future<int> futures[2];
+		{
+			std::lock_guard<std::mutex> lock(m_loadMutex);
+			futures[0] = m_recReady;
+			futures[1] = m_detReady;
+		}
+		for (const auto& future : futures)
+		{
+			if (future.valid() && future.get() != OnnxOcrResult::r_ok) ok = false;
+		}
+		return ok;
+	}
+
+	bool showResult(int result, std::wstring title)
+	{
+		switch (result)
+		{
+		case OnnxOcrResult::r_ok: return true;
+		case OnnxOcrResult::r_model_notfound: MessageBoxW(nullptr, L"模型不存在", title.c_str(), MB_ICONERROR); return false;
+		case OnnxOcrResult::r_keys_notfound: MessageBoxW(nullptr, L"Key不存在", title.c_str(), MB_ICONERROR); return false;
+		case OnnxOcrResult::r_model_invalid: MessageBoxW(nullptr, L"模型无效", title.c_str(), MB_ICONERROR); return false;
+		case OnnxOcrResult::r_keys_invalid: MessageBoxW(nullptr, L"Key无效", title.c_str(), MB_ICONERROR); return false;
+		case OnnxOcrResult::r_sdk_different: MessageBoxW(nullptr, L"Sdk不一致", title.c_str(), MB_ICONERROR); return false;
+		default: MessageBoxW(nullptr, L"未知错误", title.c_str(), MB_ICONERROR); return false;
+		}
+	}
+
+	// non-blocking, true once both models have finished loading
+	bool isInit() const
+	{
+		return loaded(m_recReady, false) && loaded(m_detReady, false);
+	}
+
+	void setConfig(const QiOcrConfig& config)
+	{
+		// waits out running loads without holding m_loadMutex, so readiness queries stay non-blocking
+		std::lock_guard<std::shared_timed_mutex> settings(m_settingsMutex);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_config = config;
+		if (!config.incremental) m_frame = Frame();
+		det->setShapeSessions(std::max(0, config.detShapeSessions));
+		det->setFuse(config.fuseModels);
+		det->setGeometryCache(std::max(0, config.geometryCache));
+		det->setArenaShrink((size_t)std::max(0, config.arenaShrinkPixels) * 3);
+		applyBudget(config);
+		for (OcrRec* recognizer : recognizers()) applyRec(*recognizer, config);
+		if (scriptCls) scriptCls->setBatchSize(std::max(1, config.recBatchSize));
+		if (directionCls) directionCls->setBatchSize(std::max(1, config.recBatchSize));
+		m_idleTimeout = config.idleUnloadMs;
+		if (config.idleUnloadMs > 0)
+		{
+			std::lock_guard<std::mutex> watchLock(m_watchMutex);
+			if (!m_idleThread.joinable()) m_idleThread = std::thread(&QiOcrTool::idleLoop, this);
+			m_watchWake.notify_all();
+		}
+	}
+
+	// det tiling and the memory budget: the whole budget caps the one shared ort arena, and each model is
+	// bounded by its own input caps, det resolution from three quarters and rec batch and width from the rest
+	void applyBudget(const QiOcrConfig& config)
+	{
+		size_t budget = (size_t)std::max(0, config.memoryBudgetMB) << 20;
+		size_t detBytes = budget / 4 * 3;
+		OcrBase::setEnvArena(budget);
+		size_t tilePixels = config.detTilePixels > 0 ? config.detTilePixels : 0;
+		size_t tileSize = std::max(0, config.detTileSize);
+		det->setMaxPixels(0);
+		if (budget)
+		{
+			// over budget inputs are tiled when tiling is available and downscaled otherwise
+			size_t maxPixels = detBytes / OcrDet::s_bytesPerPixel;
+			if (tileSize)
+			{
+				tilePixels = tilePixels ? std::min(tilePixels, maxPixels) : maxPixels;
+				tileSize = std::max<size_t>(32, std::min<size_t>(tileSize, (size_t)std::sqrt((double)maxPixels) / 32 * 32));
+			}
+			else det->setMaxPixels(maxPixels);
+		}
+		det->setTiles(tilePixels ? tileSize : 0, std::max(0, config.detTileOverlap), tilePixels);
+		det->setCoarse(std::max(0, config.detCoarseScale));
+		// the edge cut is the crop filter's contrast, so text the crop filter keeps is not masked away
+		det->setMask(std::max(0, config.detMaskTile), config.detMaskMinEdgeDensity, config.rejectMinContrast);
+		det->setAutoScale(config.detAutoScale);
+	}
+
+	// every recognizer gets the same settings, its batch and width caps come from the rec share of the budget
+	void applyRec(OcrRec& recognizer, const QiOcrConfig& config)
+	{
+		recognizer.setWidthBucket(std::max(0, config.recWidthBucket), std::max(0, config.recBucketMaxWidth));
+		recognizer.setShapeSessions(std::max(0, config.recShapeSessions));
+		recognizer.setGeometryCache(std::max(0, config.geometryCache));
+		recognizer.setFuse(config.fuseModels);
+		recognizer.setTrimPad(config.recTrimPad);
+		recognizer.cache().setCapacity(std::max(0, config.recCacheBytes), config.recCacheTolerance);
+		recognizer.setArenaShrink((size_t)std::max(0, config.arenaShrinkPixels) * 3);
+
+		size_t budget = (size_t)std::max(0, config.memoryBudgetMB) << 20;
+		size_t recBytes = budget - budget / 4 * 3;
+		size_t chunk = std::max(0, config.recChunkWidth);
+		size_t overlap = std::max(0, config.recChunkOverlap);
+		size_t packWidth = std::max(0, config.recPackWidth);
+		size_t batchSize = std::max(1, config.recBatchSize);
+		if (budget)
+		{
+			size_t columns = std::max<size_t>(recBytes / OcrRec::s_bytesPerColumn, 64);
+			overlap = std::min<size_t>(overlap, columns / 4);
+			chunk = chunk ? std::min<size_t>(chunk, columns) : columns;
+			packWidth = std::min<size_t>(packWidth, chunk);
+			batchSize = std::max<size_t>(1, std::min<size_t>(batchSize, columns / chunk));
+		}
+		recognizer.setChunk(chunk, overlap);
+		recognizer.setPacking(packWidth, std::max(0, config.recPackGap));
+		recognizer.setBatchSize(batchSize);
+	}
+
+	std::vector<OcrRec*> recognizers() const
+	{
+		std::vector<OcrRec*> list = { rec };
+		if (fallback) list.push_back(fallback);
+		list.insert(list.end(), scripts.begin(), scripts.end());
+		return list;
+	}
+
+	// loads the accurate model lines below the confidence thresholds are re-read with, it uses the
+	// primary keys; null data removes it
+	bool setFallback(void* recData, size_t recSize)
+	{
+		std::unique_ptr<OcrRec> recognizer;
+		if (recData && recSize)
+		{
+			if (!ensureRec()) return false;
+			recognizer = std::make_unique<OcrRec>();
+			{
+				// read at load, applyRec covers the rest once it is loaded
+				std::lock_guard<std::mutex> lock(m_mutex);
+				recognizer->setFuse(m_config.fuseModels);
+			}
+			if (recognizer->init(recData, recSize, rec->keys(), defaultThreads(), rec->scaleSize()) != OnnxOcrResult::r_ok) return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		delete fallback;
+		fallback = recognizer.release();
+		if (fallback) applyRec(*fallback, m_config);
+		return true;
+	}
+	bool setFallback(const std::string& model)
+	{
+		size_t modelSize;
+		std::unique_ptr<char[]> modelData;
+		if (!OcrBase::readFile(model, modelData, modelSize)) return false;
+		return setFallback(modelData.get(), modelSize);
+	}
+
+	// adds a recognizer with its own keys that lines are routed to, returns its recScript index or -1
+	int addRecognizer(void* recData, size_t recSize, void* keysData, size_t keysSize)
+	{
+		if (!recData || !recSize || !keysData || !keysSize) return -1;
+		std::unique_ptr<OcrRec> recognizer = std::make_unique<OcrRec>();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			recognizer->setFuse(m_config.fuseModels);
+		}
+		if (recognizer->init(recData, recSize, keysData, keysSize, defaultThreads(), 48) != OnnxOcrResult::r_ok) return -1;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		applyRec(*recognizer, m_config);
+		scripts.push_back(recognizer.release());
+		return (int)scripts.size();
+	}
+	int addRecognizer(const std::string& model, const std::string& keys)
+	{
+		size_t modelSize, keysSize;
+		std::unique_ptr<char[]> modelData, keysData;
+		if (!OcrBase::readFile(model, modelData, modelSize) || !OcrBase::readFile(keys, keysData, keysSize)) return -1;
+		return addRecognizer(modelData.get(), modelSize, keysData.get(), keysSize);
+	}
+
+	// null data removes the classifier
+	bool setClassifier(OcrCls*& slot, void* clsData, size_t clsSize)
+	{
+		std::unique_ptr<OcrCls> classifier;
+		if (clsData && clsSize)
+		{
+			classifier = std::make_unique<OcrCls>();
+			if (classifier->init(clsData, clsSize, defaultThreads()) != OnnxOcrResult::r_ok) return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		delete slot;
+		slot = classifier.release();
+		if (slot) slot->setBatchSize(std::max(1, m_config.recBatchSize));
+		return true;
+	}
+	bool setClassifier(OcrCls*& slot, const std::string& model)
+	{
+		size_t modelSize;
+		std::unique_ptr<char[]> modelData;
+		if (!OcrBase::readFile(model, modelData, modelSize)) return false;
+		return setClassifier(slot, modelData.get(), modelSize);
+	}
+
+	// class n of the script classifier routes a line to recognizer n, 0 being the primary
+	bool setScriptClassifier(void* clsData, size_t clsSize)
+	{
+		return setClassifier(scriptCls, clsData, clsSize);
+	}
+	bool setScriptClassifier(const std::string& model)
+	{
+		return setClassifier(scriptCls, model);
+	}
+
+	// a two class 0/180 model like the PaddleOCR cls, class 1 crops are flipped before rec
+	bool setDirectionClassifier(void* clsData, size_t clsSize)
+	{
+		return setClassifier(directionCls, clsData, clsSize);
+	}
+	bool setDirectionClassifier(const std::string& model)
+	{
+		return setClassifier(directionCls, model);
+	}
+
+	// tall crops are turned 90° counterclockwise first, so vertical columns read left to right, then
+	// one batched direction pass flips the crops it finds upside down; the caller's pixels are not touched
+	std::vector<cv::Mat> orient(const std::vector<cv::Mat>& crops)
+	{
+		std::vector<cv::Mat> oriented = crops;
+		if (m_config.recTallRatio > 0.0f)
+		{
+			for (cv::Mat& crop : oriented)
+			{
+				if (crop.empty() || crop.rows < crop.cols * m_config.recTallRatio) continue;
+				cv::Mat turned;
+				cv::rotate(crop, turned, cv::ROTATE_90_COUNTERCLOCKWISE);
+				crop = turned;
+				m_stats.recRotated++;
+			}
+		}
+		if (!directionCls) return oriented;
+
+		std::vector<OcrCls::Label> labels = directionCls->classify(oriented);
+		for (size_t i = 0; i < oriented.size(); i++)
+		{
+			if (labels[i].index != 1 || labels[i].score < m_config.directionMinScore) continue;
+			cv::Mat turned;
+			cv::rotate(oriented[i], turned, cv::ROTATE_180);
+			oriented[i] = turned;
+			m_stats.recRotated++;
+		}
+		return oriented;
+	}
+
+	// recognizer per crop: the caller's hint for the line, else recScript, else the caller supplied script
+	// classifier, else the primary; only the crops without a hint are classified
+	std::vector<size_t> route(const std::vector<cv::Mat>& crops, const std::vector<int>& hints)
+	{
+		std::vector<size_t> routes(crops.size(), 0);
+		if (scripts.empty()) return routes;
+
+		std::vector<size_t> unhinted;
+		for (size_t i = 0; i < crops.size(); i++)
+		{
+			int hint = (hints.empty() || hints[i] < 0) ? m_config.recScript : hints[i];
+			if (hint < 0) unhinted.push_back(i);
+			else if ((size_t)hint <= scripts.size()) routes[i] = hint;
+		}
+		if (!scriptCls || unhinted.empty()) return routes;
+
+		std::vector<cv::Mat> classified;
+		for (size_t i : unhinted) classified.push_back(crops[i]);
+		std::vector<OcrCls::Label> labels = scriptCls->classify(classified);
+		for (size_t i = 0; i < unhinted.size(); i++)
+		{
+			if (labels[i].index > 0 && (size_t)labels[i].index <= scripts.size()) routes[unhinted[i]] = labels[i].index;
+		}
+		return routes;
+	}
+
+	// lines are batched per recognizer, each compiles the UTF-8 charsets against its own keys, the fallback
+	// shares the primary's; charsets and hints are empty or hold one entry per line, "" / -1 = none
+	std::vector<std::string> recognize(const std::vector<cv::Mat>& lines, const std::vector<std::string>& charsets, const std::vector<int>& hints = std::vector<int>())
+	{
+		std::vector<cv::Mat> crops = orient(lines);
+		std::vector<size_t> routes = route(crops, hints);
+		std::vector<OcrText> texts(crops.size());
+		for (size_t r = 0; r <= scripts.size(); r++)
+		{
+			OcrRec* recognizer = r ? scripts[r - 1] : rec;
+			std::vector<cv::Mat> group;
+			std::vector<OcrRec::Charset> groupCharsets;
+			std::vector<size_t> owner;
+			for (size_t i = 0; i < crops.size(); i++)
+			{
+				if (routes[i] != r) continue;
+				group.push_back(crops[i]);
+				if (!charsets.empty()) groupCharsets.push_back(recognizer->charset(charsets[i].c_str()));
+				owner.push_back(i);
+			}
+			if (group.empty()) continue;
+
+			std::vector<OcrText> read = r ? recognizer->read(group, groupCharsets) : readPrimary(group, groupCharsets);
+			for (size_t i = 0; i < read.size(); i++) texts[owner[i]] = std::move(read[i]);
+		}
+
+		std::vector<std::string> result;
+		for (OcrText& text : texts) result.push_back(std::move(text.text));
+		return result;
+	}
+
+	// primary pass, then the lines below either fallback threshold go through the fallback in one batch
+	std::vector<OcrText> readPrimary(const std::vector<cv::Mat>& crops, const std::vector<OcrRec::Charset>& charsets)
+	{
+		std::vector<OcrText> texts = rec->read(crops, charsets);
+		m_stats.recLines += crops.size();
+		if (fallback && (m_config.recFallbackScore > 0.0f || m_config.recFallbackMinScore > 0.0f))
+		{
+			std::vector<cv::Mat> uncertain;
+			std::vector<OcrRec::Charset> uncertainCharsets;
+			std::vector<size_t> owner;
+			for (size_t i = 0; i < crops.size(); i++)
+			{
+				if (crops[i].empty()) continue;
+				if (texts[i].score >= m_config.recFallbackScore && texts[i].minScore >= m_config.recFallbackMinScore) continue;
+				uncertain.push_back(crops[i]);
+				if (!charsets.empty()) uncertainCharsets.push_back(charsets[i]);
+				owner.push_back(i);
+			}
+			m_stats.recEscalated += uncertain.size();
+
+			std::vector<OcrText> retried = fallback->read(uncertain, uncertainCharsets);
+			for (size_t i = 0; i < retried.size(); i++)
+			{
+				// an empty fallback result does not replace text the fast model did read
+				if (retried[i].text.empty() && !texts[owner[i]].text.empty()) continue;
+				texts[owner[i]] = std::move(retried[i]);
+			}
 		}
-		return text;
+		return texts;
+	}
+
+	QiOcrConfig config()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_config;
+	}
+
+	QiOcrStats stats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		QiOcrStats stats = m_stats;
+		for (OcrRec* recognizer : recognizers())
+		{
+			stats.recCacheHits += recognizer->cache().hits();
+			stats.recCacheMisses += recognizer->cache().misses();
+		}
+		stats.detPixelsSkipped += det->skipped();
+		stats.detRejected = det->rejected();
+		PROCESS_MEMORY_COUNTERS counters = {};
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) stats.peakWorkingSet = counters.PeakWorkingSetSize;
+		return stats;
+	}
+
+	bool acceptCrop(const cv::Mat& crop, float score) const
+	{
+		if (!m_config.rejectCrops) return true;
+		if (score < m_config.rejectMinBoxScore) return false;
+
+		cv::Mat gray;
+		cv::cvtColor(OcrBase::toBgr(crop), gray, cv::COLOR_BGR2GRAY);
+
+		double minValue, maxValue;
+		cv::minMaxLoc(gray, &minValue, &maxValue);
+		if (maxValue - minValue < m_config.rejectMinContrast) return false;
+
+		cv::Scalar mean, stddev;
+		cv::meanStdDev(gray, mean, stddev);
+		if (stddev[0] < m_config.rejectMinStdDev) return false;
+
+		if (m_config.rejectMinEdgeDensity > 0.0f && gray.cols > 1)
+		{
+			cv::Mat edges;
+			cv::absdiff(gray.colRange(1, gray.cols), gray.colRange(0, gray.cols - 1), edges);
+			cv::threshold(edges, edges, std::max(0.0f, m_config.rejectMinContrast - 1.0f), 255, cv::THRESH_BINARY);
+			double density = static_cast<double>(cv::countNonZero(edges)) / edges.total();
+			if (density < m_config.rejectMinEdgeDensity) return false;
+		}
+		return true;
+	}
+
+	std::vector<std::string> scan_list(const CImage& image, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		if (!(skipDet || ensureDet()) || !ensureRec()) return std::vector<std::string>();
+		return scanMat(toMat(image), skipDet, true, true, charset, script);
+	}
+
+	// track is set for caller scan_list/scan frames, the only inputs that feed the det text height estimate;
+	// incremental lets the frame follow the incremental config
+	std::vector<std::string> scanMat(const cv::Mat& mat, bool skipDet, bool incremental, bool track, const char* charset = nullptr, int script = -1)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (mat.empty()) return std::vector<std::string>();
+		incremental = incremental && m_config.incremental;
+
+		std::string columns = charset ? charset : "";
+		std::vector<std::string> result;
+		if (skipDet)
+		{
+			result.push_back(recognize({ mat }, { columns }, { script }).front());
+		}
+		else
+		{
+			std::vector<OcrBox> boxes;
+			std::vector<std::string> texts;
+			if (incremental)
+			{
+				scanIncremental(mat, boxes, texts, columns, script, track);
+			}
+			else
+			{
+				boxes = detectLines(mat, track);
+				texts = readBoxes(mat, boxes, columns, script);
+			}
+			for (const std::string& text : texts)
+			{
+				if (text.empty()) continue;
+				result.push_back(text);
+			}
+		}
+		return result;
+	}
+
+	// fullFrame is set for whole scan_list/scan inputs, crops, watches and dirty regions leave the text height estimate alone
+	std::vector<OcrBox> detectLines(const cv::Mat& mat, bool fullFrame = false)
+	{
+		std::vector<OcrBox> boxes = det->detect(mat, 1.0f, 0, 0.0f, fullFrame);
+		if (m_config.lineAssembly) boxes = OcrDet::assembleLines(boxes, m_config.lineMaxGap);
+		return boxes;
+	}
+
+	std::vector<std::string> readBoxes(const cv::Mat& mat, const std::vector<OcrBox>& boxes, const std::string& charset, int script)
+	{
+		std::vector<cv::Mat> textBlock;
+		std::vector<size_t> owner;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			cv::Mat crop = mat(boxes[i].rect);
+			if (!acceptCrop(crop, boxes[i].score))
+			{
+				m_stats.recRejected++;
+				continue;
+			}
+			textBlock.push_back(crop);
+			owner.push_back(i);
+		}
+
+		std::vector<std::string> texts(boxes.size());
+		std::vector<std::string> scanned = recognize(textBlock, std::vector<std::string>(charset.empty() ? 0 : textBlock.size(), charset), std::vector<int>(textBlock.size(), script));
+		for (size_t i = 0; i < scanned.size(); i++) texts[owner[i]] = std::move(scanned[i]);
+		return texts;
+	}
+
+	void scanIncremental(const cv::Mat& mat, std::vector<OcrBox>& boxes, std::vector<std::string>& texts, const std::string& charset, int script, bool track)
+	{
+		cv::Rect bounds(0, 0, mat.cols, mat.rows);
+		if (m_frame.image.size() != mat.size() || m_frame.image.type() != mat.type() || m_frame.charset != charset || m_frame.script != script)
+		{
+			boxes = detectLines(mat, track);
+			texts = readBoxes(mat, boxes, charset, script);
+			m_frame = { mat, boxes, texts, charset, script };
+			return;
+		}
+
+		int tile = AlignmentSize(std::max(32, m_config.incrementalTile), 32);
+		cv::Mat diff, changed;
+		cv::absdiff(mat, m_frame.image, diff);
+		cv::threshold(diff, diff, 8, 255, cv::THRESH_BINARY);
+		cv::cvtColor(diff, changed, cv::COLOR_BGR2GRAY);
+
+		cv::Mat dirty((mat.rows + tile - 1) / tile, (mat.cols + tile - 1) / tile, CV_8U, cv::Scalar(0));
+		for (int y = 0; y < dirty.rows; y++)
+		{
+			for (int x = 0; x < dirty.cols; x++)
+			{
+				cv::Rect rect = cv::Rect(x * tile, y * tile, tile, tile) & bounds;
+				if (cv::countNonZero(changed(rect))) dirty.at<uchar>(y, x) = 255;
+			}
+		}
+
+		if (!cv::countNonZero(dirty))
+		{
+			boxes = m_frame.boxes;
+			texts = m_frame.texts;
+			m_stats.detPixelsSkipped += bounds.area();
+			m_frame.image = mat;
+			return;
+		}
+
+		cv::dilate(dirty, dirty, cv::Mat());
+		cv::Mat labels, components, centroids;
+		int count = cv::connectedComponentsWithStats(dirty, labels, components, centroids, 8);
+
+		std::vector<cv::Rect> regions;
+		for (int i = 1; i < count; i++)
+		{
+			const int* c = components.ptr<int>(i);
+			regions.push_back(cv::Rect(c[cv::CC_STAT_LEFT] * tile, c[cv::CC_STAT_TOP] * tile, c[cv::CC_STAT_WIDTH] * tile, c[cv::CC_STAT_HEIGHT] * tile) & bounds);
+		}
+
+		for (bool grown = true; grown;)
+		{
+			grown = false;
+			for (cv::Rect& region : regions)
+			{
+				for (const OcrBox& box : m_frame.boxes)
+				{
+					if ((region & box.rect).area() <= 0) continue;
+					cv::Rect merged = region | box.rect;
+					if (merged == region) continue;
+					region = merged;
+					grown = true;
+				}
+				region = OcrDet::alignRect(region, 32) & bounds;
+			}
+			for (size_t i = 0; i < regions.size(); i++)
+			{
+				for (size_t j = i + 1; j < regions.size(); j++)
+				{
+					if ((regions[i] & regions[j]).area() <= 0) continue;
+					regions[i] |= regions[j];
+					regions.erase(regions.begin() + j--);
+					grown = true;
+				}
+			}
+		}
+
+		int64_t dirtyArea = 0;
+		for (const cv::Rect& region : regions) dirtyArea += region.area();
+		if (dirtyArea * 2 > bounds.area())
+		{
+			boxes = detectLines(mat, track);
+			texts = readBoxes(mat, boxes, charset, script);
+			m_frame = { mat, boxes, texts, charset, script };
+			return;
+		}
+
+		std::vector<OcrBox> found;
+		for (const cv::Rect& region : regions)
+		{
+			for (OcrBox box : detectLines(mat(region)))
+			{
+				box.rect += region.tl();
+				found.push_back(box);
+			}
+		}
+
+		// regions grow over whole old lines, a re-found line whose pixels did not change keeps its old text
+		std::vector<std::string> foundTexts(found.size());
+		std::vector<OcrBox> unread;
+		std::vector<size_t> unreadOwner;
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			const cv::Rect& rect = found[i].rect;
+			auto old = m_frame.boxes.end();
+			if (!cv::countNonZero(changed(rect)))
+			{
+				old = std::find_if(m_frame.boxes.begin(), m_frame.boxes.end(), [&rect, &changed](const OcrBox& box)
+					{
+						double overlap = (box.rect & rect).area();
+						return overlap * 5 >= (box.rect | rect).area() * 4 && !cv::countNonZero(changed(box.rect));
+					});
+			}
+			if (old != m_frame.boxes.end())
+			{
+				foundTexts[i] = m_frame.texts[old - m_frame.boxes.begin()];
+				continue;
+			}
+			unread.push_back(found[i]);
+			unreadOwner.push_back(i);
+		}
+		std::vector<std::string> unreadTexts = readBoxes(mat, unread, charset, script);
+		for (size_t i = 0; i < unreadTexts.size(); i++) foundTexts[unreadOwner[i]] = std::move(unreadTexts[i]);
+
+		for (size_t i = 0; i < m_frame.boxes.size(); i++)
+		{
+			bool touched = false;
+			for (const cv::Rect& region : regions) touched = touched || (region & m_frame.boxes[i].rect).area() > 0;
+			if (touched) continue;
+			found.push_back(m_frame.boxes[i]);
+			foundTexts.push_back(m_frame.texts[i]);
+		}
+
+		boxes.clear();
+		texts.clear();
+		for (size_t i : OcrDet::readingOrder(found))
+		{
+			boxes.push_back(found[i]);
+			texts.push_back(foundTexts[i]);
+		}
+		m_stats.detPixelsSkipped += bounds.area() - dirtyArea;
+		m_frame = { mat, boxes, texts, charset, script };
+	}
+
+	std::vector<std::string> scan_list(const RECT& rect, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		if (!(skipDet || ensureDet()) || !ensureRec()) return std::vector<std::string>();
+		cv::Mat mat = capture(rect);
+		if (mat.empty()) return std::vector<std::string>();
+		return scanMat(mat, skipDet, true, true, charset, script);
+	}
+
+	std::string scan(const CImage& image, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		return join(scan_list(image, skipDet, charset, script));
+	}
+
+	std::string scan(const RECT& rect, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		return join(scan_list(rect, skipDet, charset, script));
+	}
+
+	std::vector<std::string> scan_rois(const CImage& image, const RECT* rects, size_t count, int mode = QiOcrRoiMode::roi_line, const char* const* charsets = nullptr, const int* scripts = nullptr)
+	{
+		if (!rects || !(mode != QiOcrRoiMode::roi_detect || ensureDet()) || !ensureRec()) return std::vector<std::string>(count);
+		return scanRois(toMat(image), rects, count, mode, charsets, scripts);
 	}
 
-	std::string scan(const RECT& rect, bool skipDet = false)
+	std::vector<std::string> scanRois(const cv::Mat& mat, const RECT* rects, size_t count, int mode, const char* const* charsets, const int* roiScripts)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<std::string> result(count);
+		if (mat.empty()) return result;
+
+		std::vector<std::string> roiCharsets;
+		if (charsets) for (size_t i = 0; i < count; i++) roiCharsets.push_back(charsets[i] ? charsets[i] : "");
+
+		cv::Rect bounds(0, 0, mat.cols, mat.rows);
+		std::vector<cv::Mat> lines;
+		std::vector<size_t> lineOwner;
+		std::vector<OcrBox> boxes;
+		std::vector<size_t> boxOwner;
+		for (size_t i = 0; i < count; i++)
+		{
+			cv::Rect roi = cv::Rect(rects[i].left, rects[i].top, rects[i].right - rects[i].left, rects[i].bottom - rects[i].top) & bounds;
+			if (roi.width <= 0 || roi.height <= 0) continue;
+
+			if (mode == QiOcrRoiMode::roi_detect)
+			{
+				for (OcrBox box : detectLines(mat(roi)))
+				{
+					box.rect += roi.tl();
+					boxes.push_back(box);
+					boxOwner.push_back(i);
+				}
+			}
+			else
+			{
+				lines.push_back(mat(roi));
+				lineOwner.push_back(i);
+			}
+		}
+
+		std::vector<cv::Mat> crops;
+		std::vector<size_t> cropOwner;
+		for (size_t i = 0; i < boxes.size(); i++)
+		{
+			cv::Mat crop = mat(boxes[i].rect);
+			if (!acceptCrop(crop, boxes[i].score))
+			{
+				m_stats.recRejected++;
+				continue;
+			}
+			crops.push_back(crop);
+			cropOwner.push_back(boxOwner[i]);
+		}
+		crops.insert(crops.end(), lines.begin(), lines.end());
+		cropOwner.insert(cropOwner.end(), lineOwner.begin(), lineOwner.end());
+
+		std::vector<std::string> cropCharsets;
+		if (!roiCharsets.empty()) for (size_t owner : cropOwner) cropCharsets.push_back(roiCharsets[owner]);
+		std::vector<int> cropScripts;
+		if (roiScripts) for (size_t owner : cropOwner) cropScripts.push_back(roiScripts[owner]);
+		std::vector<std::string> texts = recognize(crops, cropCharsets, cropScripts);
+		for (size_t i = 0; i < texts.size(); i++)
+		{
+			if (texts[i].empty()) continue;
+			std::string& text = result[cropOwner[i]];
+			if (!text.empty()) text += "\t";
+			text += texts[i];
+		}
+		return result;
+	}
+
+	std::string scan_point(const POINT& point, int radius = 0, const char* charset = nullptr, int script = -1)
+	{
+		if (!ensureDet() || !ensureRec()) return std::string();
+		cv::Rect screen(GetSystemMetrics(SM_XVIRTUALSCREEN), GetSystemMetrics(SM_YVIRTUALSCREEN), GetSystemMetrics(SM_CXVIRTUALSCREEN), GetSystemMetrics(SM_CYVIRTUALSCREEN));
+		return scanPoint(screen, cv::Point(point.x, point.y), radius, charset, script, [](const cv::Rect& window)
+			{
+				return capture({ window.x, window.y, window.x + window.width, window.y + window.height });
+			});
+	}
+
+	std::string scan_point(const CImage& image, const POINT& point, int radius = 0, const char* charset = nullptr, int script = -1)
+	{
+		if (!ensureDet() || !ensureRec()) return std::string();
+		cv::Mat mat = toMat(image);
+		if (mat.empty()) return std::string();
+		return scanPoint(cv::Rect(0, 0, mat.cols, mat.rows), cv::Point(point.x, point.y), radius, charset, script, [&mat](const cv::Rect& window)
+			{
+				return mat(window);
+			});
+	}
+
+	template<typename Grab>
+	std::string scanPoint(const cv::Rect& bounds, const cv::Point& point, int radius, const char* charset, int script, Grab grab)
+	{
+		if (!bounds.contains(point)) return std::string();
+		if (radius <= 0) radius = 1024;
+
+		int halfWidth = std::min(radius, std::max(16, m_config.pointWindowWidth / 2));
+		int halfHeight = std::min(radius, std::max(16, m_config.pointWindowHeight / 2));
+		while (true)
+		{
+			cv::Rect window = cv::Rect(point.x - halfWidth, point.y - halfHeight, halfWidth * 2, halfHeight * 2) & bounds;
+			cv::Mat mat = grab(window);
+			if (mat.empty()) return std::string();
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			cv::Point local = point - window.tl();
+			std::vector<cv::Rect> raw;
+			std::vector<OcrBox> padded;
+			pointLines(mat, raw, padded);
+
+			// the padding of neighbouring lines overlaps, so the line whose text lies closest to the point wins
+			size_t hit = padded.size();
+			int best = 0;
+			for (size_t i = 0; i < padded.size(); i++)
+			{
+				if (!padded[i].rect.contains(local) || raw[i].empty()) continue;
+				int dx = std::max(0, std::max(raw[i].x - local.x, local.x - raw[i].br().x + 1));
+				int dy = std::max(0, std::max(raw[i].y - local.y, local.y - raw[i].br().y + 1));
+				if (hit == padded.size() || dx + dy < best)
+				{
+					hit = i;
+					best = dx + dy;
+				}
+			}
+			bool found = hit < padded.size();
+
+			bool growWidth = found && halfWidth < radius && ((raw[hit].x <= 0 && window.x > bounds.x) || (raw[hit].br().x >= window.width && window.br().x < bounds.br().x));
+			bool growHeight = found && halfHeight < radius && ((raw[hit].y <= 0 && window.y > bounds.y) || (raw[hit].br().y >= window.height && window.br().y < bounds.br().y));
+			if (!growWidth && !growHeight)
+			{
+				// counted once, for the window the answer came from
+				m_stats.detPixelsSkipped += bounds.area() - window.area();
+				return found ? recognize({ mat(padded[hit].rect) }, { charset ? charset : "" }, { script }).front() : std::string();
+			}
+
+			if (growWidth) halfWidth = std::min(radius, halfWidth * 2);
+			if (growHeight) halfHeight = std::min(radius, halfHeight * 2);
+		}
+	}
+
+	// det boxes of a point window as the raw text rects and the margin-expanded crops detectLines would give
+	void pointLines(const cv::Mat& mat, std::vector<cv::Rect>& raw, std::vector<OcrBox>& padded)
+	{
+		cv::Rect bounds(0, 0, mat.cols, mat.rows);
+		std::vector<OcrBox> found = det->detect(mat, 0.0f);
+		std::vector<OcrBox> expanded;
+		for (const OcrBox& box : found)
+		{
+			int margin = box.rect.height;
+			cv::Rect rect(box.rect.x - margin, box.rect.y - margin, box.rect.width + 2 * margin, box.rect.height + 2 * margin);
+			expanded.push_back({ rect & bounds, box.score });
+		}
+		padded = m_config.lineAssembly ? OcrDet::assembleLines(expanded, m_config.lineMaxGap) : expanded;
+
+		raw.assign(padded.size(), cv::Rect());
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			auto line = std::find_if(padded.begin(), padded.end(), [&expanded, i](const OcrBox& line) { return (line.rect & expanded[i].rect) == expanded[i].rect; });
+			if (line == padded.end()) continue;
+			cv::Rect& rect = raw[line - padded.begin()];
+			rect = rect.empty() ? found[i].rect : (rect | found[i].rect);
+		}
+	}
+
+	std::vector<QiOcrBox> detect(const CImage& image)
+	{
+		return detectMat(toMat(image), cv::Point(0, 0), 0);
+	}
+
+	std::vector<QiOcrBox> detect(const RECT& rect)
+	{
+		return detectMat(capture(rect), cv::Point(rect.left, rect.top), 0);
+	}
+
+	bool has_text(const CImage& image)
+	{
+		return !detectMat(toMat(image), cv::Point(0, 0), 1).empty();
+	}
+
+	bool has_text(const RECT& rect)
+	{
+		return !detectMat(capture(rect), cv::Point(rect.left, rect.top), 1).empty();
+	}
+
+	std::vector<QiOcrBox> detectMat(const cv::Mat& mat, const cv::Point& offset, size_t limit)
+	{
+		std::vector<QiOcrBox> result;
+		if (mat.empty() || !ensureDet()) return result;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (const OcrBox& box : det->detect(mat, s_boxMargin, limit, m_config.rejectCrops ? m_config.rejectMinBoxScore : 0.0f))
+		{
+			cv::Rect r = box.rect + offset;
+			result.push_back({ { r.x, r.y, r.x + r.width, r.y + r.height }, box.score });
+		}
+		return result;
+	}
+
+	int watch(const RECT& rect, unsigned int interval, QiOcrWatchCallback callback, void* user)
+	{
+		if (!callback || rect.right <= rect.left || rect.bottom <= rect.top) return 0;
+
+		std::lock_guard<std::mutex> lock(m_watchMutex);
+		int id = ++m_watchId;
+		m_watches[id] = { rect, std::chrono::milliseconds(std::max(10u, interval)), callback, user, std::chrono::steady_clock::now(), 0, false, std::string() };
+		if (!m_watchThread.joinable()) m_watchThread = std::thread(&QiOcrTool::watchLoop, this);
+		m_watchWake.notify_all();
+		return id;
+	}
+
+	void unwatch(int id)
+	{
+		std::lock_guard<std::mutex> lock(m_watchMutex);
+		m_watches.erase(id);
+	}
+
+	void watchLoop()
+	{
+		std::unique_lock<std::mutex> lock(m_watchMutex);
+		while (!m_watchStop)
+		{
+			auto now = std::chrono::steady_clock::now();
+			auto next = now + std::chrono::seconds(1);
+			std::vector<std::pair<int, Watch>> due;
+			for (auto& i : m_watches)
+			{
+				if (i.second.due <= now)
+				{
+					due.emplace_back(i.first, i.second);
+					i.second.due = now + i.second.interval;
+				}
+				next = std::min(next, i.second.due);
+			}
+			if (due.empty())
+			{
+				m_watchWake.wait_until(lock, next);
+				continue;
+			}
+
+			lock.unlock();
+			std::vector<bool> changed = pollWatches(due);
+			lock.lock();
+
+			std::vector<std::pair<int, Watch>> notify;
+			for (size_t i = 0; i < due.size(); i++)
+			{
+				auto found = m_watches.find(due[i].first);
+				if (found == m_watches.end()) continue;
+				found->second.hash = due[i].second.hash;
+				found->second.scanned = due[i].second.scanned;
+				found->second.text = due[i].second.text;
+				if (changed[i]) notify.push_back(due[i]);
+			}
+
+			lock.unlock();
+			for (const auto& i : notify) i.second.callback(i.first, i.second.text.c_str(), i.second.user);
+			lock.lock();
+		}
+	}
+
+	void idleLoop()
+	{
+		std::unique_lock<std::mutex> lock(m_watchMutex);
+		while (!m_watchStop)
+		{
+			int timeout = m_idleTimeout;
+			if (timeout <= 0)
+			{
+				m_watchWake.wait(lock);
+				continue;
+			}
+
+			auto idle = std::chrono::steady_clock::now() - std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(m_lastUse));
+			if (idle < std::chrono::milliseconds(timeout))
+			{
+				m_watchWake.wait_for(lock, std::chrono::milliseconds(timeout) - idle);
+				continue;
+			}
+
+			lock.unlock();
+			bool recLoaded = loaded(m_recReady, false);
+			bool detLoaded = loaded(m_detReady, false);
+			{
+				std::lock_guard<std::mutex> scanLock(m_mutex);
+				if (recLoaded) rec->unload();
+				if (fallback) fallback->unload();
+				for (OcrRec* recognizer : scripts) recognizer->unload();
+				if (scriptCls) scriptCls->unload();
+				if (directionCls) directionCls->unload();
+				if (detLoaded) det->unload();
+				m_frame = Frame();
+			}
+			lock.lock();
+			m_watchWake.wait_for(lock, std::chrono::milliseconds(timeout));
+		}
+	}
+
+	std::vector<bool> pollWatches(std::vector<std::pair<int, Watch>>& watches)
+	{
+		std::vector<bool> changed(watches.size(), false);
+		if (!ensureDet(false) || !ensureRec(false)) return changed;
+
+		RECT bounds = watches.front().second.rect;
+		int64_t area = 0;
+		for (const auto& i : watches)
+		{
+			const RECT& r = i.second.rect;
+			bounds.left = std::min(bounds.left, r.left);
+			bounds.top = std::min(bounds.top, r.top);
+			bounds.right = std::max(bounds.right, r.right);
+			bounds.bottom = std::max(bounds.bottom, r.bottom);
+			area += (int64_t)(r.right - r.left) * (r.bottom - r.top);
+		}
+		cv::Mat screen;
+		if ((int64_t)(bounds.right - bounds.left) * (bounds.bottom - bounds.top) <= area * 4) screen = capture(bounds);
+
+		for (size_t i = 0; i < watches.size(); i++)
+		{
+			Watch& w = watches[i].second;
+			cv::Mat region;
+			if (screen.empty()) region = capture(w.rect);
+			else region = screen(cv::Rect(w.rect.left - bounds.left, w.rect.top - bounds.top, w.rect.right - w.rect.left, w.rect.bottom - w.rect.top));
+			if (region.empty()) continue;
+
+			uint64_t hash = OcrBase::hashImage(region);
+			if (w.scanned && hash == w.hash) continue;
+			w.hash = hash;
+
+			std::string text = join(scanMat(region.clone(), false, false, false));
+			if (w.scanned && text == w.text) continue;
+			w.text = text;
+			w.scanned = true;
+			changed[i] = true;
+		}
+		return changed;
+	}
+
+	static std::string join(const std::vector<std::string>& result)
 	{
-		std::vector<std::string> result = scan_list(rect);
 		std::string text;
 		for (const std::string& i : result)
 		{
@@ -535,6 +3032,23 @@ public:
 		return text;
 	}
 
+	static cv::Mat capture(const RECT& rect)
+	{
+		int w = rect.right - rect.left;
+		int h = rect.bottom - rect.top;
+		cv::Mat mat;
+		if (w > 0 && h > 0)
+		{
+			CImage image; image.Create(w, h, 32);
+			HDC hdc = GetDC(nullptr);
+			bool captured = BitBlt(image.GetDC(), 0, 0, w, h, hdc, rect.left, rect.top, SRCCOPY);
+			image.ReleaseDC();
+			ReleaseDC(nullptr, hdc);
+			if (captured) mat = toMat(image);
+		}
+		return mat;
+	}
+
 	static cv::Mat toMat(const CImage& image)
 	{
 		int width = image.GetWidth();
@@ -1,6 +1,15 @@
 ﻿#include <QiOcrInterface.h>
 #include "QiOcr.h"
 
+// copies the first size bytes of a QiOcrConfig or QiOcrStats, the part both sides of the boundary know
+template<typename T>
+static void copySized(T& to, const T& from, unsigned int size)
+{
+	unsigned int keep = to.size;
+	memcpy(&to, &from, std::min<size_t>(size, sizeof(T)));
+	to.size = keep;
+}
+
 struct QiOcrInterfaceDef : QiOcrInterface
 {
 	std::vector<std::string> scan_list(const CImage& image, bool skipDet = false)
@@ -19,10 +28,113 @@ struct QiOcrInterfaceDef : QiOcrInterface
 	{
 		return ocr->scan(rect_screen, skipDet);
 	}
-	QiOcrInterfaceDef() : ocr(new QiOcrTool())
+	void set_config(const QiOcrConfig& config)
+	{
+		QiOcrConfig merged = ocr->config();
+		copySized(merged, config, config.size);
+		ocr->setConfig(merged);
+	}
+	void get_config(QiOcrConfig& config)
+	{
+		copySized(config, ocr->config(), config.size);
+	}
+	void get_stats(QiOcrStats& stats)
+	{
+		copySized(stats, ocr->stats(), stats.size);
+	}
+	int watch(const RECT& rect_screen, unsigned int interval, QiOcrWatchCallback callback, void* user = nullptr)
+	{
+		return ocr->watch(rect_screen, interval, callback, user);
+	}
+	void unwatch(int id)
+	{
+		ocr->unwatch(id);
+	}
+	std::vector<QiOcrBox> detect(const CImage& image)
+	{
+		return ocr->detect(image);
+	}
+	std::vector<QiOcrBox> detect(const RECT& rect_screen)
+	{
+		return ocr->detect(rect_screen);
+	}
+	bool has_text(const CImage& image)
+	{
+		return ocr->has_text(image);
+	}
+	bool has_text(const RECT& rect_screen)
+	{
+		return ocr->has_text(rect_screen);
+	}
+	std::string scan_point(const POINT& point_screen, int radius = 0, const char* charset = nullptr, int script = -1)
+	{
+		return ocr->scan_point(point_screen, radius, charset, script);
+	}
+	std::string scan_point(const CImage& image, const POINT& point, int radius = 0, const char* charset = nullptr, int script = -1)
+	{
+		return ocr->scan_point(image, point, radius, charset, script);
+	}
+	std::vector<std::string> scan_rois(const CImage& image, const RECT* rects, size_t count, int mode = QiOcrRoiMode::roi_line, const char* const* charsets = nullptr, const int* scripts = nullptr)
+	{
+		return ocr->scan_rois(image, rects, count, mode, charsets, scripts);
+	}
+	bool is_init()
+	{
+		return ocr->isInit();
+	}
+	bool set_fallback(const char* model_file)
+	{
+		return model_file ? ocr->setFallback(std::string(model_file)) : ocr->setFallback(nullptr, 0);
+	}
+	bool set_fallback(void* recData, size_t recSize)
+	{
+		return ocr->setFallback(recData, recSize);
+	}
+	int add_recognizer(const char* model_file, const char* keys_file)
+	{
+		if (!model_file || !keys_file) return -1;
+		return ocr->addRecognizer(std::string(model_file), std::string(keys_file));
+	}
+	int add_recognizer(void* recData, size_t recSize, void* keysData, size_t keysSize)
 	{
+		return ocr->addRecognizer(recData, recSize, keysData, keysSize);
 	}
-	QiOcrInterfaceDef(void* recData, size_t recSize, void* keyData, size_t keySize, void* detData, size_t detSize) : ocr(new QiOcrTool(recData, recSize, keyData, keySize, detData, detSize))
+	bool set_script_classifier(const char* model_file)
+	{
+		return model_file ? ocr->setScriptClassifier(std::string(model_file)) : ocr->setScriptClassifier(nullptr, 0);
+	}
+	bool set_script_classifier(void* clsData, size_t clsSize)
+	{
+		return ocr->setScriptClassifier(clsData, clsSize);
+	}
+	bool set_direction_classifier(const char* model_file)
+	{
+		return model_file ? ocr->setDirectionClassifier(std::string(model_file)) : ocr->setDirectionClassifier(nullptr, 0);
+	}
+	bool set_direction_classifier(void* clsData, size_t clsSize)
+	{
+		return ocr->setDirectionClassifier(clsData, clsSize);
+	}
+	std::vector<std::string> scan_list_ex(const CImage& image, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		return ocr->scan_list(image, skipDet, charset, script);
+	}
+	std::vector<std::string> scan_list_ex(const RECT& rect_screen, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		return ocr->scan_list(rect_screen, skipDet, charset, script);
+	}
+	std::string scan_ex(const CImage& image, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		return ocr->scan(image, skipDet, charset, script);
+	}
+	std::string scan_ex(const RECT& rect_screen, bool skipDet = false, const char* charset = nullptr, int script = -1)
+	{
+		return ocr->scan(rect_screen, skipDet, charset, script);
+	}
+	QiOcrInterfaceDef(const QiOcrConfig& config) : ocr(new QiOcrTool(config))
+	{
+	}
+	QiOcrInterfaceDef(void* recData, size_t recSize, void* keyData, size_t keySize, void* detData, size_t detSize, const QiOcrConfig& config) : ocr(new QiOcrTool(recData, recSize, keyData, keySize, detData, detSize, config))
 	{
 	}
 	~QiOcrInterfaceDef()
@@ -35,10 +147,12 @@ struct QiOcrInterfaceDef : QiOcrInterface
 #ifdef QIOCR_SHARED
 extern "C" __declspec(dllexport)
 #endif
-QiOcrInterface* _stdcall QiOcrInterfaceInitInterface()
+QiOcrInterface* _stdcall QiOcrInterfaceInitInterfaceEx(const QiOcrConfig* config)
 {
-	QiOcrInterfaceDef* ocr = new QiOcrInterfaceDef();
-	if (ocr->ocr->isInit()) return (QiOcrInterface*)ocr;
+	QiOcrConfig merged;
+	if (config) copySized(merged, *config, config->size);
+	QiOcrInterfaceDef* ocr = new QiOcrInterfaceDef(merged);
+	if (ocr->ocr->waitInit()) return (QiOcrInterface*)ocr;
 	delete ocr;
 	return nullptr;
 }
@@ -46,21 +160,39 @@ QiOcrInterface* _stdcall QiOcrInterfaceInitInterface()
 #ifdef QIOCR_SHARED
 extern "C" __declspec(dllexport)
 #endif
-QiOcrInterface* _stdcall QiOcrInterfaceInitInterfaceFromMemory(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize)
+QiOcrInterface* _stdcall QiOcrInterfaceInitInterfaceFromMemoryEx(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize, const QiOcrConfig* config)
 {
-	QiOcrInterfaceDef* ocr = new QiOcrInterfaceDef(recData, recSize, keysData, keysSize, detData, detSize);
-	if (ocr->ocr->isInit()) return (QiOcrInterface*)ocr;
+	QiOcrConfig merged;
+	if (config) copySized(merged, *config, config->size);
+	QiOcrInterfaceDef* ocr = new QiOcrInterfaceDef(recData, recSize, keysData, keysSize, detData, detSize, merged);
+	if (ocr->ocr->waitInit()) return (QiOcrInterface*)ocr;
 	delete ocr;
 	return nullptr;
 }
 
+#ifdef QIOCR_SHARED
+extern "C" __declspec(dllexport)
+#endif
+QiOcrInterface* _stdcall QiOcrInterfaceInitInterface()
+{
+	return QiOcrInterfaceInitInterfaceEx(nullptr);
+}
+
+#ifdef QIOCR_SHARED
+extern "C" __declspec(dllexport)
+#endif
+QiOcrInterface* _stdcall QiOcrInterfaceInitInterfaceFromMemory(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize)
+{
+	return QiOcrInterfaceInitInterfaceFromMemoryEx(recData, recSize, keysData, keysSize, detData, detSize, nullptr);
+}
+
 #ifndef QIOCR_SHARED
-QiOcrInterface* QiOcrInterfaceInit()
+QiOcrInterface* QiOcrInterfaceInit(const QiOcrConfig* config)
 {
-	return QiOcrInterfaceInitInterface();
+	return QiOcrInterfaceInitInterfaceEx(config);
 }
-QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize)
+QiOcrInterface* QiOcrInterfaceInit(void* recData, size_t recSize, void* keysData, size_t keysSize, void* detData, size_t detSize, const QiOcrConfig* config)
 {
-	return QiOcrInterfaceInitInterfaceFromMemory(recData, recSize, keysData, keysSize, detData, detSize);
+	return QiOcrInterfaceInitInterfaceFromMemoryEx(recData, recSize, keysData, keysSize, detData, detSize, config);
 }
 #endif
\ No newline at end of file